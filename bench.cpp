@@ -0,0 +1,335 @@
+/*
+** QuBit - Benchmarks
+**
+** Times each family of operations for int, float and double superpositions
+** of 10 to 10^7 states, and writes the results as JSON, e.g.
+**	qubench -b 2 -o bench.json
+**
+** Several operations are O(n^2) or worse (Add checks for duplicates, and a
+** pairwise result has up to n^2 states), so a sweep stops early once the
+** next size is predicted to take longer than the budget. The sizes reached
+** are in the results.
+*/
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include "quBit.hpp"
+#include "quSample.hpp"
+#include "quPerf.hpp"
+
+using namespace std;
+
+/* Each measurement repeats until it has run for at least this long */
+#define QUBIT_BENCH_MIN_TIME	0.02
+#define QUBIT_BENCH_MAX_REPS	1000000
+
+
+struct CQuBenchResult {
+	string	m_Case;
+	string	m_Type;
+	size_t	m_iSize;
+	double	m_fSeconds;		/* per call */
+	size_t	m_iReps;
+	size_t	m_iStates;		/* in the result, as a check that work was done */
+	CQuPerfSample m_Perf;	/* hardware counts per call, where available */
+};
+
+static double	g_fBudget = 2.0;
+static size_t	g_iMaxSize = 10000000;
+static vector<CQuBenchResult> g_Results;
+
+
+static double Now(void)
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+** Times fn, which returns the number of states it produced, and returns
+** the seconds per call.
+*/
+static double Measure(const char *pCase, const char *pType, size_t iSize, const function<size_t(void)> &fn)
+{
+CQuBenchResult r;
+CQuPerfSample perf;
+double fStart = Now(), fElapsed;
+size_t iReps = 0, iStates = 0;
+int i;
+
+	{
+	CQuPerfRegion region(perf);
+
+		do
+			{
+			iStates = fn();
+			iReps++;
+			fElapsed = Now() - fStart;
+			}
+		while(fElapsed < QUBIT_BENCH_MIN_TIME && iReps < QUBIT_BENCH_MAX_REPS);
+	}
+
+	for(i=0;i<eQuPerfCount;i++)
+		r.m_Perf.m_iCount[i] = perf.m_iCount[i] / iReps;
+
+	r.m_Case = pCase;
+	r.m_Type = pType;
+	r.m_iSize = iSize;
+	r.m_fSeconds = fElapsed / iReps;
+	r.m_iReps = iReps;
+	r.m_iStates = iStates;
+	g_Results.push_back(r);
+
+	fprintf(stderr, "%-16s %-6s %9lu  %12.3f us\n", pCase, pType, (unsigned long)iSize, r.m_fSeconds*1e6);
+	return r.m_fSeconds;
+}
+
+/*
+** Runs one case over increasing sizes, up to iMaxSize, and returns the
+** largest size run. The time for the next size is extrapolated from the
+** growth between the last two, and the sweep ends when it would exceed the
+** budget. setup, if given, prepares the inputs for each size untimed.
+*/
+static size_t Sweep(const char *pCase, const char *pType, const function<size_t(size_t)> &fn,
+					size_t iMaxSize = 0, const function<void(size_t)> &setup = NULL)
+{
+double fLast = 0, fPrev = 0, fPredict;
+size_t iSize, iDone = 0;
+
+	if (iMaxSize == 0 || iMaxSize > g_iMaxSize)
+		iMaxSize = g_iMaxSize;
+
+	for(iSize=10;iSize<=iMaxSize;iSize*=10)
+		{
+		if (fLast > 0)
+			{
+			fPredict = fPrev > 0 ? fLast * (fLast / fPrev) : fLast * 10;
+			if (fPredict > g_fBudget)
+				break;
+			}
+		if (setup)
+			setup(iSize);
+		fPrev = fLast;
+		fLast = Measure(pCase, pType, iSize, [&]() { return fn(iSize); });
+		iDone = iSize;
+		}
+	return iDone;
+}
+
+
+/*
+** Operator families, for one type
+*/
+template <typename _T>
+class CQuBench {
+
+	public:
+		CQuBench(const char *pType) : m_pType(pType), m_iMaxInput(0) {}
+
+		size_t	GetMaxInput(void) const	{ return m_iMaxInput; }
+
+		void	Run(void)
+				{
+				function<void(size_t)> prepare = [&](size_t n) { Prepare(n); };
+
+				/* Inputs are built as add_range builds them, so are only as large as it reached */
+				m_iMaxInput = Sweep("add_range", m_pType, [&](size_t n) { CQuBit<_T> q((_T)1, (_T)n); return q.GetCount(); });
+				Sweep("add", m_pType, [&](size_t n)
+					{
+					CQuBit<_T> q;
+					size_t i;
+
+						/* every other state is a duplicate */
+						for(i=0;i<n;i++)
+							q.Add((_T)(i/2));
+						return q.GetCount();
+					});
+
+				Sweep("scalar_add", m_pType, [&](size_t n) { return (Input(n) + (_T)3).GetCount(); }, m_iMaxInput, prepare);
+				Sweep("scalar_mul", m_pType, [&](size_t n) { return (Input(n) * (_T)3).GetCount(); }, m_iMaxInput, prepare);
+				Sweep("scalar_div", m_pType, [&](size_t n) { return (Input(n) / (_T)3).GetCount(); }, m_iMaxInput, prepare);
+				Sweep("scalar_mod", m_pType, [&](size_t n) { return (Input(n) % (_T)7).GetCount(); }, m_iMaxInput, prepare);
+				Sweep("pairwise_add", m_pType, [&](size_t n) { return (Input(n) + Input(n)).GetCount(); }, m_iMaxInput, prepare);
+				Sweep("pairwise_mul", m_pType, [&](size_t n) { return (Input(n) * Input(n)).GetCount(); }, m_iMaxInput, prepare);
+
+				Sweep("cond_scalar", m_pType, [&](size_t n) { return (Input(n) < (_T)(n/2)).GetEigenCount(); }, m_iMaxInput, prepare);
+				Sweep("cond_pairwise", m_pType, [&](size_t n) { return (Input(n).Any() <= Input(n).All()).GetEigenCount(); }, m_iMaxInput, prepare);
+				Sweep("where_mul_lt", m_pType, [&](size_t n) { return Input(n).Where(eQuOpMul, Input(n), eQuCoLt, (_T)n).GetEigenCount(); }, m_iMaxInput, prepare);
+				Sweep("eigenstates", m_pType, [&](size_t n) { return (Input(n) < (_T)(n/2)).Eigenstates().GetCount(); }, m_iMaxInput, prepare);
+
+				Sweep("any_union", m_pType, [&](size_t n) { return Input(n).Any(Input(n), Shifted(n)).GetCount(); }, m_iMaxInput, prepare);
+				Sweep("all_intersect", m_pType, [&](size_t n) { return Input(n).All(Input(n), Shifted(n)).GetCount(); }, m_iMaxInput, prepare);
+
+				Sweep("stream_out", m_pType, [&](size_t n)
+					{
+					ostringstream os;
+
+						os << Input(n);
+						return (size_t)os.tellp();
+					}, m_iMaxInput, prepare);
+				Sweep("stream_in", m_pType, [&](size_t n)
+					{
+					istringstream is(Text(n));
+					CQuBit<_T> q;
+
+						is >> q;
+						return q.GetCount();
+					}, m_iMaxInput, prepare);
+				}
+
+	protected:
+		void	Prepare(size_t n)		{ Input(n); Shifted(n); Text(n); }
+
+		/* The states 1..n, and n/2+1..n+n/2, built once for each size */
+		CQuBit<_T> &Input(size_t n)		{ return cached(m_Input, n, 1); }
+		CQuBit<_T> &Shifted(size_t n)	{ return cached(m_Shifted, n, n/2+1); }
+		string	&Text(size_t n)
+				{
+				ostringstream os;
+
+					if (m_Text.size() <= Log10(n))
+						m_Text.resize(Log10(n)+1);
+					if (m_Text[Log10(n)].empty())
+						{
+						os << Input(n);
+						m_Text[Log10(n)] = os.str();
+						}
+					return m_Text[Log10(n)];
+				}
+
+		CQuBit<_T> &cached(vector<CQuBit<_T> > &v, size_t n, size_t iFirst)
+				{
+				size_t i = Log10(n);
+
+					if (v.size() <= i)
+						v.resize(i+1);
+					if (v[i].GetCount() == 0)
+						v[i] = CQuBit<_T>((_T)iFirst, (_T)(iFirst+n-1));
+					return v[i];
+				}
+		static size_t Log10(size_t n)
+				{
+				size_t i = 0;
+
+					while(n >= 10) { n /= 10; i++; }
+					return i;
+				}
+
+		const char *				m_pType;
+		size_t						m_iMaxInput;
+		vector<CQuBit<_T> >			m_Input;
+		vector<CQuBit<_T> >			m_Shifted;
+		vector<string>				m_Text;
+};
+
+
+/*
+** quSample
+*/
+static void RunSamples(size_t iMaxInput)
+{
+CQuBit<int> q;
+
+	Sweep("qisprime_batch", "int", [&](size_t n)
+		{
+		vector<int> in(n);
+		vector<bool> out;
+		size_t i, iPrimes = 0;
+
+			for(i=0;i<n;i++)
+				in[i] = (int)i;
+			QIsPrime(in, out);
+			for(i=0;i<n;i++)
+				iPrimes += out[i];
+			return iPrimes;
+		});
+	Sweep("qfactors", "int", [&](size_t n) { return QFactors((int)n).GetCount(); });
+	Sweep("qgcd", "int", [&](size_t n) { return QGCD((int)n, (int)(n/2 + n/5)).GetCount(); });
+	Sweep("qmin", "int", [&](size_t) { return Qmin(q).GetCount(); },
+		iMaxInput, [&](size_t n) { q = CQuBit<int>(1, (int)n); });
+}
+
+
+static void WriteJSON(ostream &os)
+{
+CQuPerfCounters &counters = CQuPerfCounters::Local();
+size_t i;
+int j;
+bool bFirst = true;
+
+	os << "{\n";
+	os << "  \"benchmark\": \"qubench\",\n";
+	os << "  \"threads\": " << QuGetThreadCount() << ",\n";
+	os << "  \"perf\": [";
+	for(j=0;j<eQuPerfCount;j++)
+		if (counters.IsAvailable((tQuPerfEvent)j))
+			{
+			os << (bFirst ? "\"" : ", \"") << CQuPerfSample::GetName((tQuPerfEvent)j) << "\"";
+			bFirst = false;
+			}
+	os << "],\n";
+	os << "  \"budget\": " << g_fBudget << ",\n";
+	os << "  \"results\": [\n";
+	for(i=0;i<g_Results.size();i++)
+		{
+		const CQuBenchResult &r = g_Results[i];
+
+		os << "    { \"case\": \"" << r.m_Case << "\", \"type\": \"" << r.m_Type << "\", "
+		   << "\"size\": " << r.m_iSize << ", \"seconds\": " << r.m_fSeconds << ", "
+		   << "\"reps\": " << r.m_iReps << ", \"states\": " << r.m_iStates;
+		/* per call, and only for the counters that could be opened */
+		for(j=0;j<eQuPerfCount;j++)
+			if (counters.IsAvailable((tQuPerfEvent)j))
+				os << ", \"" << CQuPerfSample::GetName((tQuPerfEvent)j) << "\": " << r.m_Perf.m_iCount[j];
+		os << " }"
+		   << (i+1 < g_Results.size() ? ",\n" : "\n");
+		}
+	os << "  ]\n";
+	os << "}\n";
+}
+
+
+int main(int argc, char* argv[])
+{
+const char *pOutput = NULL;
+int i;
+
+	for(i=1;i<argc;i++)
+		{
+		if (strcmp(argv[i], "-b") == 0 && i+1 < argc)
+			g_fBudget = atof(argv[++i]);
+		else if (strcmp(argv[i], "-m") == 0 && i+1 < argc)
+			g_iMaxSize = (size_t)atof(argv[++i]);
+		else if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+			pOutput = argv[++i];
+		else
+			{
+			fprintf(stderr, "usage: %s [-b budget seconds per sweep] [-m max states] [-o output.json]\n", argv[0]);
+			return 1;
+			}
+		}
+
+	CQuBench<int> benchInt("int");
+	CQuBench<float> benchFloat("float");
+	CQuBench<double> benchDouble("double");
+
+	benchInt.Run();
+	benchFloat.Run();
+	benchDouble.Run();
+	RunSamples(benchInt.GetMaxInput());
+
+	if (pOutput)
+		{
+		ofstream os(pOutput);
+
+		WriteJSON(os);
+		}
+	else
+		WriteJSON(cout);
+
+	return 0;
+}
@@ -6,10 +6,16 @@
 int main(int argc, char* argv[])
 {
 CQuBit<float> ans;
+vector<int> candidates;
+vector<bool> primes;
 int i;
 
 	for(i=1;i<100;i++) {
-		if (QIsPrime(i)) {
+		candidates.push_back(i);
+	}
+	QIsPrime(candidates, primes);
+	for(i=1;i<100;i++) {
+		if (primes[i-1]) {
 			cout<< i << " is prime!\n";
 		}
 	}
@@ -39,6 +45,27 @@ int i;
 	answer = minvalue.Any() <= minvalue.All();
 	cout << "The lowest is:" << answer.Eigenstates() << endl;
 
+	// Code Sample #4
+	// QIsPrime's PERL form, (i % all(2..sqrt(i)+1)) != 0, for every candidate
+	// at once. One all(2..10) is shared, and each candidate only sees the
+	// divisors up to its own sqrt(i)+1.
+	CQuBit<int> divisors(2,10);
+	vector<CQuBit<int> > results;
+	vector<size_t> prefix;
+	int iAgree = 0;
+
+	for(i=1;i<100;i++) {
+		int iLast = (int)(sqrt((float)i)+1.0f);
+		prefix.push_back(iLast >= 2 ? iLast-1 : 0);
+	}
+	divisors.All().BatchCondition(candidates, eQuOpMod, eQuCoNeq, 0, results, false, &prefix);
+	for(i=2;i<100;i++) {
+		if ((i==2 || results[i-1].GetBoolResult()) == primes[i-1]) {
+			iAgree++;
+		}
+	}
+	cout << "The batch test agrees for " << iAgree << " of the 98 candidates from 2 to 99" << endl;
+
 	return 0;
 }
 
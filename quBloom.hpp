@@ -0,0 +1,112 @@
+#ifndef QUBLOOM_H
+#define QUBLOOM_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Blocked Bloom filters, for probes that mostly miss
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+#include "quCache.hpp"
+
+using namespace std;
+
+/* Bits of filter per state. About 1 in 100 absent values gets through at this size. */
+#define QUBIT_BLOOM_BITS		12
+/* Bits set per state, each within the state's block */
+#define QUBIT_BLOOM_PROBES		7
+
+
+inline atomic<size_t> &QuBloomRef(void)
+{
+static atomic<size_t> iMin(0);
+
+	return iMin;
+}
+
+/*
+** Superpositions of at least iStates states keep a Bloom filter of their
+** states, built the first time a scalar is looked for (with ==, != or
+** Contains) or they are intersected with, and dropped when they change.
+** A value the filter has never seen is then known to be absent without
+** looking at a single state. 0 (the default) never builds one.
+**
+** A filter costs a pass over the states to build, and is shared by copies
+** made afterwards, so it pays for superpositions that are kept and probed
+** many times, e.g.
+**	CQuBit<int> any = q.Any();
+**	for(...) if ((any == v).GetBoolResult()) ...
+** rather than q.Any() == v, whose temporary builds one each time.
+*/
+inline void QuSetBloomMin(size_t iStates)
+{
+	QuBloomRef() = iStates;
+}
+
+inline size_t QuGetBloomMin(void)
+{
+	return QuBloomRef();
+}
+
+
+/*
+** A Bloom filter cut into blocks of one cache line. Each value sets (and a
+** probe tests) QUBIT_BLOOM_PROBES bits within a single block, chosen by its
+** hash, so a probe costs at most one cache miss. Values are added by hash;
+** see CQuBit::bloom_hash for what two equal states hash to.
+*/
+class CQuBloom {
+
+	public:
+		CQuBloom(size_t iValues)
+					{
+					size_t iBlocks = (iValues*QUBIT_BLOOM_BITS + 511) / 512;
+
+						m_Blocks.resize(iBlocks ? iBlocks : 1);
+					}
+
+		void		Insert(uint64_t h)
+					{
+					CQuBloomBlock &b = block(h);
+					uint64_t iBits = QuMix64(h);
+					int i;
+
+						for(i=0;i<QUBIT_BLOOM_PROBES;i++,iBits>>=9)
+							b.m_Words[(iBits >> 6) & 7] |= (uint64_t)1 << (iBits & 63);
+					}
+		/* False if the value was certainly never inserted */
+		bool		MayContain(uint64_t h) const
+					{
+					const CQuBloomBlock &b = block(h);
+					uint64_t iBits = QuMix64(h);
+					int i;
+
+						for(i=0;i<QUBIT_BLOOM_PROBES;i++,iBits>>=9)
+							if (!(b.m_Words[(iBits >> 6) & 7] & ((uint64_t)1 << (iBits & 63))))
+								return false;
+						return true;
+					}
+
+inline	size_t		GetBytes(void) const	{ return m_Blocks.size()*sizeof(CQuBloomBlock); }
+
+	private:
+		struct alignas(64) CQuBloomBlock {
+			uint64_t	m_Words[8];
+
+			CQuBloomBlock()		{ for(int i=0;i<8;i++) m_Words[i] = 0; }
+		};
+
+		/* the high bits of h pick the block, as (h * blocks) / 2^64 */
+		CQuBloomBlock &			block(uint64_t h)		{ return m_Blocks[(size_t)(((unsigned __int128)h * m_Blocks.size()) >> 64)]; }
+		const CQuBloomBlock &	block(uint64_t h) const	{ return m_Blocks[(size_t)(((unsigned __int128)h * m_Blocks.size()) >> 64)]; }
+
+		vector<CQuBloomBlock>	m_Blocks;
+};
+
+
+#endif	// QUBLOOM_H
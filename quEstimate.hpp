@@ -0,0 +1,98 @@
+#ifndef QUESTIMATE_H
+#define QUESTIMATE_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Estimates of filtered products, from random pairs
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+
+using namespace std;
+
+/* Pairs drawn when no budget is given */
+#define QUBIT_ESTIMATE_SAMPLES	100000
+/* Pairs drawn between looks at the clock */
+#define QUBIT_ESTIMATE_CLOCK	4096
+/* 95% two-sided */
+#define QUBIT_ESTIMATE_Z		1.959964
+
+
+/*
+** The Wilson score interval for a proportion, after iPassed of iSamples
+** passed. Unlike the normal approximation it stays within [0,1], and is
+** still sensible when nothing (or everything) passed.
+*/
+inline void QuWilson(size_t iPassed, size_t iSamples, double fZ, double &fLo, double &fHi)
+{
+double n = (double)iSamples, p, z2, fDenom, fCentre, fHalf;
+
+	if (iSamples == 0)
+		{
+		fLo = 0;
+		fHi = 1;
+		return;
+		}
+	p = iPassed / n;
+	z2 = fZ*fZ;
+	fDenom = 1 + z2/n;
+	fCentre = (p + z2/(2*n)) / fDenom;
+	fHalf = fZ * sqrt(p*(1-p)/n + z2/(4*n*n)) / fDenom;
+	fLo = fCentre - fHalf < 0 ? 0 : fCentre - fHalf;
+	fHi = fCentre + fHalf > 1 ? 1 : fCentre + fHalf;
+}
+
+
+/*
+** What CQuBit::Estimate found of ((a OP b) COND rhs) from uniformly drawn
+** pairs of states. Intervals are at the confidence Estimate was given
+** (95% by default). When the budget covered every pair, each pair was
+** visited once instead, and everything is exact (m_bExact). If the time ran
+** out before the last pair, the intervals are the bounds the unvisited pairs
+** leave, as those were not drawn at random.
+*/
+template <typename _T>
+struct CQuEstimate {
+	bool		m_bExact;
+	double		m_fPairs;			/* in the whole product, i.e. a.GetCount() * b.GetCount() */
+	size_t		m_iSamples;			/* pairs drawn */
+	size_t		m_iPassed;			/* of which passed COND */
+
+	/* The share of all pairs that pass */
+	double		m_fFraction;
+	double		m_fFractionLo;
+	double		m_fFractionHi;
+
+	/* The collapsed result, as Where would give it: for a conjunction, whether
+	   every pair passes; for a disjunction, whether any does. A failing (or
+	   passing) pair settles it, and m_bCertain is set. Otherwise m_fFractionHi
+	   (or 1 - m_fFractionLo) bounds the share of pairs that could overturn it. */
+	bool		m_bResult;
+	bool		m_bCertain;
+
+	/* The eigenstates are the distinct passing values, so number no more than
+	   the passing pairs, and no fewer than were seen. The estimate between is
+	   Chao's, from how many values were seen just once or twice. */
+	double		m_fEigenCount;
+	double		m_fEigenLo;
+	double		m_fEigenHi;
+	vector<_T>	m_Seen;				/* the distinct passing values drawn, in order */
+
+	CQuEstimate() : m_bExact(false), m_fPairs(0), m_iSamples(0), m_iPassed(0),
+					m_fFraction(0), m_fFractionLo(0), m_fFractionHi(1),
+					m_bResult(false), m_bCertain(false),
+					m_fEigenCount(0), m_fEigenLo(0), m_fEigenHi(0) {}
+
+	/* Passing pairs, scaled up from the share */
+	double		GetPassing(void) const		{ return m_fFraction * m_fPairs; }
+	double		GetPassingLo(void) const	{ return m_fFractionLo * m_fPairs; }
+	double		GetPassingHi(void) const	{ return m_fFractionHi * m_fPairs; }
+};
+
+
+#endif	// QUESTIMATE_H
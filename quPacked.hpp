@@ -0,0 +1,326 @@
+#ifndef QUPACKED_H
+#define QUPACKED_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Compressed storage for large integer superpositions
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <stdint.h>
+#include "quBit.hpp"
+
+using namespace std;
+
+/* States per block. Each block is decoded as a whole, into a buffer on the stack. */
+#define QUBIT_PACKED_BLOCK		128
+
+
+/*
+** The states of an integer superposition, sorted and cut into blocks of
+** QUBIT_PACKED_BLOCK. A block keeps its least and greatest states, and the
+** gaps between successive states (less one) bit-packed at the width of its
+** widest gap. A run of consecutive integers therefore takes no bits at all,
+** and clustered states only a few, rather than sizeof(_T) bytes each.
+**
+** Membership and comparisons with a scalar find their block from the
+** block bounds, and decode at most one block (or one at each end of a
+** range), so most states are never unpacked. e.g.
+**	CQuPacked<int64_t> packed(huge);
+**	huge.Clear();
+**	if (packed.Contains(x)) ...
+**	CQuBit<int64_t> small = packed.Condition(eQuCoLt, limit);
+**
+** Only the states and whether they are a conjunction or disjunction are
+** kept, so the order they were added in is lost: Unpack gives them in
+** ascending order. Weighted, collapsed and tolerant superpositions can not
+** be packed.
+*/
+template <typename _T>
+class CQuPacked {
+
+	static_assert(is_integral<_T>::value, "CQuPacked holds integer states");
+
+	typedef typename CQuBit<_T>::tQuSuper	tQuSuper;
+
+	public:
+		CQuPacked()							{ Clear(); }
+		CQuPacked(const CQuBit<_T> &q)		{ Pack(q); }
+
+		void		Clear(void)
+					{
+						m_Mins.clear();
+						m_Blocks.clear();
+						m_Words.clear();
+						m_iCount = 0;
+						m_eType = CQuBit<_T>::eConj;
+					}
+		/* False (and empty) if q can not be packed */
+		bool		Pack(const CQuBit<_T> &q)
+					{
+					vector<_T> sorted;
+					size_t i;
+
+						Clear();
+						if (q.IsWeighted() || q.HasTolerance() || q.GetType() == CQuBit<_T>::eCollapsedResult)
+							return false;
+
+						sorted.assign(q.m_qList.begin(), q.m_qList.end());
+						sort(sorted.begin(), sorted.end());
+						for(i=0;i<sorted.size();i+=QUBIT_PACKED_BLOCK)
+							pack_block(&sorted[i], min(sorted.size() - i, (size_t)QUBIT_PACKED_BLOCK));
+						m_Mins.shrink_to_fit();
+						m_Blocks.shrink_to_fit();
+						m_Words.shrink_to_fit();
+						m_iCount = sorted.size();
+						m_eType = q.GetType();
+						return true;
+					}
+		CQuBit<_T>	Unpack(void) const
+					{
+					CQuBit<_T> ans;
+
+						ans.m_qList.resize(m_iCount);
+						decode_range(0, m_iCount, ans.m_qList.data());
+						ans.SetType(m_eType);
+						return ans;
+					}
+
+inline	size_t		GetCount(void) const	{ return m_iCount; }
+inline	size_t		GetBlocks(void) const	{ return m_Blocks.size(); }
+		/* Memory held, against GetCount()*sizeof(_T) unpacked */
+		size_t		GetBytes(void) const
+					{
+						return m_Words.capacity()*sizeof(uint64_t) + m_Blocks.capacity()*sizeof(CQuPackedBlock) +
+							   m_Mins.capacity()*sizeof(_T);
+					}
+		/* (_T)0 if there are no states, as GetItem does */
+		_T			GetMin(void) const		{ return m_iCount ? m_Mins[0] : (_T)0; }
+		_T			GetMax(void) const		{ return m_iCount ? m_Blocks.back().m_Max : (_T)0; }
+
+		bool		Contains(const _T &v) const
+					{
+					typename vector<_T>::const_iterator it = upper_bound(m_Mins.begin(), m_Mins.end(), v);
+					_T states[QUBIT_PACKED_BLOCK];
+					size_t iBlock, i, n;
+
+						if (it == m_Mins.begin())
+							return false;
+						iBlock = it - m_Mins.begin() - 1;
+						if (m_Blocks[iBlock].m_Max < v)
+							return false;
+						n = decode(iBlock, states);
+						for(i=0;i<n && states[i] < v;i++)
+							;
+						return i < n && states[i] == v;
+					}
+		/* The number of states for which (state COND rhs) holds */
+		size_t		GetCountIf(tQuCond co, const _T &rhs) const
+					{
+					size_t iFirst, iEnd;
+
+						passing(co, rhs, iFirst, iEnd);
+						return co == eQuCoNeq ? m_iCount - (iEnd - iFirst) : iEnd - iFirst;
+					}
+		/* (q COND rhs), collapsed as it would be, with the eigenstates in ascending order */
+		CQuBit<_T>	Condition(tQuCond co, const _T &rhs) const
+					{
+					CQuBit<_T> ans;
+					size_t iFirst, iEnd;
+
+						passing(co, rhs, iFirst, iEnd);
+						if (co == eQuCoNeq)
+							{
+							ans.m_Eigenstates.resize(m_iCount - (iEnd - iFirst));
+							decode_range(0, iFirst, ans.m_Eigenstates.data());
+							decode_range(iEnd, m_iCount, ans.m_Eigenstates.data() + iFirst);
+							}
+						else
+							{
+							ans.m_Eigenstates.resize(iEnd - iFirst);
+							decode_range(iFirst, iEnd, ans.m_Eigenstates.data());
+							}
+						ans.SetType(CQuBit<_T>::eCollapsedResult);
+						ans.m_eEigenType = m_eType;
+						ans.m_bResult = m_eType == CQuBit<_T>::eConj ? ans.m_Eigenstates.size() == m_iCount :
+																	   !ans.m_Eigenstates.empty();
+						return ans;
+					}
+
+		/* Calls fn(state) for every state, in ascending order, a block at a time */
+		template <typename _F>
+		void		ForEach(_F fn) const
+					{
+					_T states[QUBIT_PACKED_BLOCK];
+					size_t iBlock, i, n;
+
+						for(iBlock=0;iBlock<m_Blocks.size();iBlock++)
+							{
+							n = decode(iBlock, states);
+							for(i=0;i<n;i++)
+								fn(states[i]);
+							}
+					}
+		/* The states of one block into pOut, which must have room for QUBIT_PACKED_BLOCK. Returns how many. */
+		size_t		Decode(size_t iBlock, _T *pOut) const
+					{
+						return iBlock < m_Blocks.size() ? decode(iBlock, pOut) : 0;
+					}
+
+	private:
+		struct CQuPackedBlock {
+			uint64_t	m_iOffset;		/* of its first gap, in bits into m_Words */
+			uint32_t	m_iCount;
+			uint32_t	m_iBits;		/* per gap, 0..64 */
+			_T			m_Max;
+		};
+
+		/* The bit pattern of a state. Differences of these wrap correctly for signed types too. */
+		static uint64_t	bits(const _T &v)	{ return (uint64_t)v; }
+
+		void		pack_block(const _T *p, size_t n)
+					{
+					CQuPackedBlock block;
+					uint64_t iWidest = 0, iGap, iPos;
+					size_t i;
+
+						for(i=1;i<n;i++)
+							{
+							iGap = bits(p[i]) - bits(p[i-1]) - 1;
+							if (iGap > iWidest)
+								iWidest = iGap;
+							}
+						block.m_iOffset = iPos = m_Words.size()*64;
+						block.m_iCount = (uint32_t)n;
+						block.m_iBits = 0;
+						while(block.m_iBits < 64 && (iWidest >> block.m_iBits))
+							block.m_iBits++;
+						block.m_Max = p[n-1];
+
+						/* blocks start on a word, so each decodes on its own */
+						m_Words.resize(m_Words.size() + ((n-1)*block.m_iBits + 63)/64, 0);
+						if (block.m_iBits)
+							for(i=1;i<n;i++,iPos+=block.m_iBits)
+								put(iPos, block.m_iBits, bits(p[i]) - bits(p[i-1]) - 1);
+
+						m_Mins.push_back(p[0]);
+						m_Blocks.push_back(block);
+					}
+		void		put(uint64_t iPos, unsigned iBits, uint64_t v)
+					{
+					size_t iWord = iPos >> 6;
+					unsigned iShift = iPos & 63;
+
+						m_Words[iWord] |= v << iShift;
+						if (iShift + iBits > 64)
+							m_Words[iWord+1] |= v >> (64 - iShift);
+					}
+
+		/* The gaps are all unpacked first (each independently of the others), then summed */
+		size_t		decode(size_t iBlock, _T *pOut) const
+					{
+					const CQuPackedBlock &block = m_Blocks[iBlock];
+					const uint64_t *pWords = m_Words.data();
+					uint64_t gaps[QUBIT_PACKED_BLOCK];
+					uint64_t iMask = block.m_iBits == 64 ? ~(uint64_t)0 : ((uint64_t)1 << block.m_iBits) - 1;
+					uint64_t iPos, iLow, iHigh, v;
+					unsigned iShift;
+					size_t i, n = block.m_iCount;
+
+						if (block.m_iBits == 0)
+							for(i=1;i<n;i++)
+								gaps[i] = 0;
+						else
+							for(i=1,iPos=block.m_iOffset;i<n;i++,iPos+=block.m_iBits)
+								{
+								iShift = iPos & 63;
+								iLow = pWords[iPos >> 6] >> iShift;
+								/* and the next word, where the gap runs into it */
+								iHigh = iShift + block.m_iBits > 64 ? pWords[(iPos >> 6) + 1] << (64 - iShift) : 0;
+								gaps[i] = (iLow | iHigh) & iMask;
+								}
+
+						v = bits(m_Mins[iBlock]);
+						pOut[0] = m_Mins[iBlock];
+						for(i=1;i<n;i++)
+							{
+							v += gaps[i] + 1;
+							pOut[i] = (_T)v;
+							}
+						return n;
+					}
+		/* States iFirst..iEnd-1, in ascending order, into pOut */
+		void		decode_range(size_t iFirst, size_t iEnd, _T *pOut) const
+					{
+					_T states[QUBIT_PACKED_BLOCK];
+					size_t iBlock, iFrom, iTo;
+
+						for(iBlock=iFirst/QUBIT_PACKED_BLOCK;iFirst<iEnd;iBlock++)
+							{
+							iFrom = iFirst - iBlock*QUBIT_PACKED_BLOCK;
+							iTo = min(iEnd - iBlock*QUBIT_PACKED_BLOCK, (size_t)m_Blocks[iBlock].m_iCount);
+							if (iFrom == 0 && iTo == m_Blocks[iBlock].m_iCount)
+								decode(iBlock, pOut);
+							else
+								{
+								decode(iBlock, states);
+								copy(states + iFrom, states + iTo, pOut);
+								}
+							pOut += iTo - iFrom;
+							iFirst += iTo - iFrom;
+							}
+					}
+
+		/* The number of states below v (or, if bInclusive, not above it) */
+		size_t		rank(const _T &v, bool bInclusive) const
+					{
+					typename vector<_T>::const_iterator it;
+					_T states[QUBIT_PACKED_BLOCK];
+					size_t iBlock, i, n;
+
+						it = bInclusive ? upper_bound(m_Mins.begin(), m_Mins.end(), v) : lower_bound(m_Mins.begin(), m_Mins.end(), v);
+						if (it == m_Mins.begin())
+							return 0;
+						iBlock = it - m_Mins.begin() - 1;
+						n = m_Blocks[iBlock].m_iCount;
+						if (bInclusive ? !(v < m_Blocks[iBlock].m_Max) : m_Blocks[iBlock].m_Max < v)
+							return iBlock*QUBIT_PACKED_BLOCK + n;
+
+						decode(iBlock, states);
+						for(i=0;i<n && (bInclusive ? !(v < states[i]) : states[i] < v);i++)
+							;
+						return iBlock*QUBIT_PACKED_BLOCK + i;
+					}
+		/* The states (by rank) for which COND holds are iFirst..iEnd-1, or for !=, all the others */
+		void		passing(tQuCond co, const _T &rhs, size_t &iFirst, size_t &iEnd) const
+					{
+						iFirst = 0;
+						iEnd = m_iCount;
+						switch(co)
+							{
+							case eQuCoLt:	iEnd = rank(rhs, false);	break;
+							case eQuCoLte:	iEnd = rank(rhs, true);		break;
+							case eQuCoGt:	iFirst = rank(rhs, true);	break;
+							case eQuCoGte:	iFirst = rank(rhs, false);	break;
+							case eQuCoEq:
+							case eQuCoNeq:
+								iFirst = rank(rhs, false);
+								iEnd = rank(rhs, true);
+								break;
+							}
+					}
+
+		vector<_T>				m_Mins;		/* each block's least state, searched apart from the rest */
+		vector<CQuPackedBlock>	m_Blocks;
+		vector<uint64_t>		m_Words;
+		size_t					m_iCount;
+		tQuSuper				m_eType;
+};
+
+
+#endif	// QUPACKED_H
@@ -0,0 +1,155 @@
+#ifndef QURANDOM_H
+#define QURANDOM_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Random engines for observing superpositions
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <random>
+#include <atomic>
+#include <stdint.h>
+
+using namespace std;
+
+
+/*
+** xoshiro256** (Blackman & Vigna). Small, fast, and with no shared state,
+** so every thread can observe superpositions with its own engine. It meets
+** the standard's UniformRandomBitGenerator requirements, so it may also be
+** used with <random>, and any such engine may be passed to CQuBit in its place.
+*/
+class CQuRandom {
+
+	public:
+		typedef uint64_t result_type;
+
+		CQuRandom(uint64_t iSeed = 0, uint64_t iStream = 0) { Seed(iSeed, iStream); }
+
+		/* Engines with the same seed and stream produce the same sequence */
+		void		Seed(uint64_t iSeed, uint64_t iStream = 0)
+					{
+					uint64_t x = iSeed ^ Mix(iStream + 0x9e3779b97f4a7c15ULL);
+					int i;
+
+						for(i=0;i<4;i++)
+							m_s[i] = SplitMix(x);
+					}
+
+		uint64_t	operator()(void)
+					{
+					const uint64_t iResult = Rotl(m_s[1] * 5, 7) * 9;
+					const uint64_t t = m_s[1] << 17;
+
+						m_s[2] ^= m_s[0];
+						m_s[3] ^= m_s[1];
+						m_s[1] ^= m_s[2];
+						m_s[0] ^= m_s[3];
+						m_s[2] ^= t;
+						m_s[3] = Rotl(m_s[3], 45);
+						return iResult;
+					}
+		static constexpr uint64_t min(void)	{ return 0; }
+		static constexpr uint64_t max(void)	{ return ~(uint64_t)0; }
+
+		/* uniform in [0,1) */
+		double		NextUnit(void)		{ return (double)((*this)() >> 11) * (1.0 / 9007199254740992.0); }
+		/* uniform in [0,n), without modulo bias */
+		uint64_t	NextIndex(uint64_t n)
+					{
+#ifdef __SIZEOF_INT128__
+						return (uint64_t)(((unsigned __int128)(*this)() * n) >> 64);
+#else
+						uint64_t i = (uint64_t)(NextUnit() * n);
+						return i < n ? i : n-1;
+#endif
+					}
+
+		/*
+		** The calling thread's own engine. Unless QuSeedAll has been called,
+		** each is seeded from std::random_device when the thread first uses it.
+		*/
+		static CQuRandom &Local(void);
+
+	private:
+		static uint64_t Rotl(uint64_t x, int k)	{ return (x << k) | (x >> (64 - k)); }
+		static uint64_t SplitMix(uint64_t &x)
+					{
+						x += 0x9e3779b97f4a7c15ULL;
+						return Mix(x);
+					}
+		static uint64_t Mix(uint64_t z)
+					{
+						z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+						z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+						return z ^ (z >> 31);
+					}
+
+		uint64_t	m_s[4];
+};
+
+
+/* Base seed for threads' engines, and the number of engines handed out so far */
+inline atomic<uint64_t> &QuRandomBase(void)		{ static atomic<uint64_t> iBase(0); return iBase; }
+inline atomic<bool> &QuRandomSeeded(void)		{ static atomic<bool> bSeeded(false); return bSeeded; }
+inline atomic<uint64_t> &QuRandomStreams(void)	{ static atomic<uint64_t> iStreams(0); return iStreams; }
+
+inline CQuRandom QuNewThreadEngine(void)
+{
+uint64_t iStream = QuRandomStreams()++;
+random_device rd;
+
+	if (QuRandomSeeded())
+		return CQuRandom(QuRandomBase(), iStream);
+	return CQuRandom(((uint64_t)rd() << 32) ^ rd(), iStream);
+}
+
+inline CQuRandom &CQuRandom::Local(void)
+{
+static thread_local CQuRandom local(QuNewThreadEngine());
+
+	return local;
+}
+
+/* Seeds the calling thread's engine. Each thread may pick its own stream. */
+inline void QuSeed(uint64_t iSeed, uint64_t iStream = 0)
+{
+	CQuRandom::Local().Seed(iSeed, iStream);
+}
+
+/* Seeds the calling thread, and gives threads that first use their engine
+   afterwards streams 1, 2, 3... of the same seed. The numbering follows the
+   order in which threads start drawing; for a stream per thread that does
+   not depend on timing, call QuSeed(seed, stream) in each thread instead. */
+inline void QuSeedAll(uint64_t iSeed)
+{
+CQuRandom &local = CQuRandom::Local();	/* first, so its creation does not use up stream 1 */
+
+	QuRandomBase() = iSeed;
+	QuRandomSeeded() = true;
+	QuRandomStreams() = 1;
+	local.Seed(iSeed, 0);
+}
+
+
+/*
+** Uniform draws from any engine, with a fast path for CQuRandom
+*/
+template <typename _RNG>
+inline double QuRandomUnit(_RNG &rng)		{ return generate_canonical<double, 53>(rng); }
+inline double QuRandomUnit(CQuRandom &rng)	{ return rng.NextUnit(); }
+
+template <typename _RNG>
+inline size_t QuRandomIndex(_RNG &rng, size_t n)
+{
+size_t i = (size_t)(QuRandomUnit(rng) * n);
+
+	return i < n ? i : n-1;
+}
+inline size_t QuRandomIndex(CQuRandom &rng, size_t n)	{ return (size_t)rng.NextIndex(n); }
+
+
+#endif	// QURANDOM_H
@@ -0,0 +1,114 @@
+#ifndef QUREGISTER_H
+#define QUREGISTER_H
+
+/*
+** QuBit - Quantum Superposition Library
+** State-vector simulation of a register of real qubits
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <vector>
+#include <complex>
+#include <stdint.h>
+#include "quBit.hpp"
+
+using namespace std;
+
+/* Define QUBIT_REGISTER_SINGLE to halve the memory needed (8GB at 30 qubits) */
+#ifdef QUBIT_REGISTER_SINGLE
+typedef float	tQuReal;
+#else
+typedef double	tQuReal;
+#endif
+typedef complex<tQuReal>	tQuAmplitude;
+
+/* The most qubits a register may have. At 30, the state takes 16GB (8GB single). */
+#ifndef QUBIT_REGISTER_MAX_QUBITS
+#define QUBIT_REGISTER_MAX_QUBITS	30
+#endif
+
+/* Basis states less likely than this are left out of Measure() */
+#define QUBIT_REGISTER_EPSILON	1e-12
+
+
+/*
+** A register of n qubits, held as its 2^n complex amplitudes. Qubit 0 is
+** the least significant bit of a basis state's index.
+**
+** Gates are applied in place. Each gate pairs every amplitude whose target
+** bit is 0 with its partner whose target bit is 1; the pairs are visited in
+** contiguous runs (so both halves stream through the cache together, and the
+** inner loop can be vectorised) and the runs are shared out between threads.
+** Controls are given as a mask of qubits that must all be 1.
+**
+** A register asked for more than QUBIT_REGISTER_MAX_QUBITS qubits is
+** created empty (see IsValid). Gates, and Reset, check every qubit and basis
+** index they are given, and return false without touching the state if one
+** is out of range, or if a gate's target is also one of its controls.
+*/
+class CQuRegister {
+
+	public:
+		CQuRegister(unsigned iQubits);
+
+inline	bool			IsValid(void) const		{ return !m_State.empty(); }
+inline	unsigned		GetQubits(void) const	{ return m_iQubits; }
+inline	uint64_t		GetSize(void) const		{ return m_State.size(); }
+		/* 0 for a basis state out of range */
+inline	tQuAmplitude	GetAmplitude(uint64_t iBasis) const { return iBasis < m_State.size() ? m_State[iBasis] : tQuAmplitude(0); }
+		double			GetProbability(uint64_t iBasis) const { return norm(GetAmplitude(iBasis)); }
+		double			GetNorm(void) const;	/* sum of the probabilities, i.e. 1 */
+
+		bool			Reset(uint64_t iBasis = 0);	/* to the single basis state given */
+
+		/*
+		** Gates
+		** m is the 2x2 unitary in row-major order: { m00, m01, m10, m11 }
+		*/
+		bool			Apply(const tQuAmplitude m[4], unsigned iTarget, uint64_t iControls = 0);
+
+		bool			H(unsigned q);
+		bool			X(unsigned q);
+		bool			Y(unsigned q);
+		bool			Z(unsigned q);
+		bool			S(unsigned q);
+		bool			T(unsigned q);
+		bool			Phase(unsigned q, double fAngle);
+		bool			Rx(unsigned q, double fAngle);
+		bool			Ry(unsigned q, double fAngle);
+		bool			Rz(unsigned q, double fAngle);
+
+		bool			CNOT(unsigned iControl, unsigned iTarget);
+		bool			CZ(unsigned iControl, unsigned iTarget);
+		bool			Toffoli(unsigned iControl1, unsigned iControl2, unsigned iTarget);
+		bool			Swap(unsigned a, unsigned b);
+		/* X on the target, controlled on every qubit in the mask */
+		bool			MCX(uint64_t iControls, unsigned iTarget);
+
+		/*
+		** Measurement
+		*/
+		/* Every basis state that could be observed, weighted by its probability.
+		   The register itself is left untouched. */
+		CQuBit<uint64_t> Measure(void) const;
+		/* Observes the whole register, which collapses to the basis state seen */
+		uint64_t		Collapse(void);
+		/* Observes one qubit, and renormalises what is left. A qubit out of
+		   range reads as 0, and leaves the state alone. */
+		bool			MeasureQubit(unsigned q);
+
+	private:
+		void			apply_range(const tQuAmplitude m[4], uint64_t iStride, uint64_t iControls,
+									uint64_t kBegin, uint64_t kEnd);
+		double			probability_one(unsigned q) const;
+		void			scale(tQuReal fScale);
+inline	bool			is_qubit(unsigned q) const	{ return q < m_iQubits; }
+
+		unsigned				m_iQubits;
+		vector<tQuAmplitude>	m_State;
+};
+
+
+#endif	// QUREGISTER_H
@@ -3,48 +3,72 @@
 */
 #include <math.h>
 #include "quBit.hpp"
+#include "quSieve.hpp"
 #include "quSample.hpp"
 
 
 CQuBit<int> Qmin(CQuBit<int> &ql)
 {
 	// PERL: eigenstates(any(@_) <= any(@_))
-	return (ql.Any() <= ql.All()).Eigenstates();
+	// which is (ql.Any() <= ql.All()).Eigenstates(), but in linear time
+	return ql.Min().Any();
 }
 
 
 CQuBit<int> Qmax(CQuBit<int> &ql)
 {
 	// PERL: eigenstates(any(@_) >= any(@_))
-	return (ql.Any() >= ql.All()).Eigenstates();
+	// which is (ql.Any() >= ql.All()).Eigenstates(), but in linear time
+	return ql.Max().Any();
 }
 
 
+/*
+** The primality and factor samples below are answered from a shared
+** smallest-prime-factor sieve, rather than by building a divisor
+** superposition for every call. The original superposition forms are
+** given in the PERL comments (and in readme.html) for comparison.
+*/
 bool QIsPrime(int i)
 {
 // PERL: $_[0]==2 || $_[0] % all(2..sqrt($_[0])+1) != 0
 
-CQuBit<int> prime, ans;
+	if (i < 2)	return false;
+	return CQuSieve::Get().IsPrime((uint32_t)i);
+}
 
-	if (i==2)	return true;
-	prime.AddRange(2, (int)(sqrt((float)i)+1.0f));
-	ans = (i % prime.All()) != 0;
-	return ans.GetBoolResult();
+
+void QIsPrime(const vector<int> &in, vector<bool> &out)
+{
+int iMax = 2;
+size_t i;
+
+	for(i=0;i<in.size();i++)
+		if (in[i] > iMax)	iMax = in[i];
+	CQuSieve::Get().Reserve((uint32_t)iMax);
+
+	out.resize(in.size());
+	for(i=0;i<in.size();i++)
+		out[i] = QIsPrime(in[i]);
 }
 
 
 CQuBit<float> QFactors(int v)
 {
-	float i = (float)v;
 // PERL: $q = $n / any(2..$n-1); eigenstates(floor($q)==$q);
 // or    eigenstates( int($_[0] / any(2..$n-1)) == ($_[0] / any(2..$n-1)
-CQuBit<float> n, q;
+// i.e. every divisor except 1 and $n, largest first
 CQuBit<float> results;
+vector<uint32_t> divisors;
+size_t i;
 
-	n.AddRange(2.0f, (float)(i-1));
-	q = i/n.Any();
-	q = q.Floor()==q;
-	return q.Eigenstates();
+	if (v > 1)
+		CQuSieve::Get().Divisors((uint32_t)v, divisors);
+
+	for(i=divisors.size();i-->0;)
+		if (divisors[i] != 1 && divisors[i] != (uint32_t)v)
+			results.Add((float)divisors[i]);
+	return results.Any();
 }
 
 
@@ -52,12 +76,30 @@ CQuBit<float> QGCD(int a, int b)
 {
 // PERL: $common = all(any(factors($x)), any(factors($y)));
 //		any(eigenstates $common) > all(eigenstates $common);
-CQuBit<float> af, bf, ans;
+// so the largest divisor shared by the two factor sets above
+CQuBit<float> ans;
+vector<uint32_t> af, bf;
+size_t i, j;
+
+	if (a > 1)	CQuSieve::Get().Divisors((uint32_t)a, af);
+	if (b > 1)	CQuSieve::Get().Divisors((uint32_t)b, bf);
 
-	af = QFactors(a);
-	bf = QFactors(b);
-	ans = af.All(af, bf);
-	return (ans.Any() >= ans.All()).Eigenstates();
+	/* both are sorted, so walk them down together from the top */
+	i = af.size();
+	j = bf.size();
+	while(i > 0 && j > 0)
+		{
+		if (af[i-1] > bf[j-1])		i--;
+		else if (af[i-1] < bf[j-1])	j--;
+		else if (af[i-1] == (uint32_t)a || af[i-1] == (uint32_t)b) { i--; j--; }
+		else
+			{
+			if (af[i-1] != 1)
+				ans.Add((float)af[i-1]);
+			break;
+			}
+		}
+	return ans.Any();
 }
 
 int GetQGCD(int a, int b)
@@ -4,6 +4,7 @@
 CQuBit<int> Qmin(CQuBit<int> &ql);
 CQuBit<int> Qmax(CQuBit<int> &ql);
 bool QIsPrime(int i);
+void QIsPrime(const vector<int> &in, vector<bool> &out);
 CQuBit<float> QFactors(int i);
 CQuBit<float> QGCD(int a, int b);
 int GetQGCD(int a, int b);
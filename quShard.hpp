@@ -0,0 +1,473 @@
+#ifndef QUSHARD_H
+#define QUSHARD_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Sharded evaluation in worker processes
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <type_traits>
+#include <stdint.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#define QUBIT_SHARD_FORK
+#endif
+#include "quBit.hpp"
+
+using namespace std;
+
+/* Below this many pairs, a job is not worth a process, and is run in the caller */
+#ifndef QUBIT_SHARD_GRAIN
+#define QUBIT_SHARD_GRAIN		(1<<22)
+#endif
+/* A shard whose worker dies (or hangs) is given to a fresh worker this many times */
+#define QUBIT_SHARD_RETRIES		1
+/* Seconds a round of workers may take before those still running are killed */
+#ifndef QUBIT_SHARD_TIMEOUT
+#define QUBIT_SHARD_TIMEOUT		600.0
+#endif
+/* The longest wait between looks at the workers, in milliseconds */
+#define QUBIT_SHARD_POLL_MAX	20
+
+#define QUBIT_SHARD_MAGIC		0x5175536861726431ULL
+
+
+/*
+** Splits the pairs of a pairwise operation or condition between forked
+** worker processes, by contiguous runs of the left operand's states, e.g.
+**	CQuShard<int> shard(4);
+**	CQuBit<int> sum;
+**	if (shard.Oper(sum, a, eQuOpAdd, b))
+**		...
+**
+** The operands are handed over in one POSIX shared memory segment, and each
+** worker returns its distinct results (or eigenstates) in a segment of its
+** own, so nothing is sent over a network, or through pipes. Each worker
+** evaluates its run with the usual planner, and the results are merged in
+** run order, so the states (and their order) are exactly those of the
+** single process expression. Weights are summed per run and then merged,
+** so may differ from it by rounding.
+**
+** A worker that crashes, is killed, or cannot return its results leaves the
+** caller untouched: its run goes to a fresh worker, and if that dies too the
+** call returns false with an empty result. A worker still running when the
+** timeout (SetTimeout, 0 for none) runs out, or once the caller's job is
+** cancelled (see CQuProgress), is killed and counts as having died. Only when
+** no process can be forked is a run evaluated in the caller.
+**
+** Small jobs, and those with a tolerance or a collapsed operand, are evaluated
+** in the caller as ever. Fork only while no other thread is inside a QuBit
+** operation (the result cache's lock would be copied as it stood). The
+** workers' QUBIT_STATS counters stay in the workers. Older glibc needs -lrt.
+*/
+template <typename _T>
+class CQuShard {
+
+	static_assert(is_trivially_copyable<_T>::value, "CQuShard copies states through shared memory");
+
+	typedef typename CQuBit<_T>::cbOperation		cbOperation;
+	typedef typename CQuBit<_T>::cbCondOperation	cbCondOperation;
+	typedef typename CQuBit<_T>::tQuSuper			tQuSuper;
+	typedef typename CQuBit<_T>::tQuStates			tQuStates;
+
+	public:
+		/* 0 workers selects one per hardware core, as QuSetThreadCount does */
+		CQuShard(size_t iWorkers = 0) : m_iWorkers(iWorkers), m_fTimeout(QUBIT_SHARD_TIMEOUT), m_iFailed(0), m_iLocal(0) {}
+
+		void		SetWorkers(size_t iWorkers)	{ m_iWorkers = iWorkers; }
+		size_t		GetWorkers(void) const
+					{
+						return m_iWorkers ? m_iWorkers : QuGetThreadCount();
+					}
+		void		SetTimeout(double fSeconds)	{ m_fTimeout = fSeconds > 0 ? fSeconds : 0; }
+inline	double		GetTimeout(void) const		{ return m_fTimeout; }
+		/* For the last call: workers that died, and runs evaluated in the caller */
+inline	size_t		GetFailed(void) const	{ return m_iFailed; }
+inline	size_t		GetLocal(void) const	{ return m_iLocal; }
+
+		/* a OP b */
+		bool		Oper(CQuBit<_T> &ans, const CQuBit<_T> &a, tQuOper op, const CQuBit<_T> &b)
+					{
+						return run(ans, a, b, CQuBit<_T>::oper_of(op), NULL);
+					}
+		/* a COND b, collapsed as the expression is */
+		bool		Condition(CQuBit<_T> &ans, const CQuBit<_T> &a, tQuCond co, const CQuBit<_T> &b)
+					{
+						return run(ans, a, b, NULL, CQuBit<_T>::cond_of(co));
+					}
+
+	private:
+		typedef chrono::steady_clock::time_point	tQuClock;
+
+		/* The start of each segment. The operands' weights (if any) follow, then their states */
+		struct CQuShardHeader {
+			uint64_t	m_iMagic;
+			uint64_t	m_iLhs, m_iRhs;			/* operand states, or results and 0 */
+			uint32_t	m_eLhs, m_eRhs;			/* tQuSuper */
+			uint32_t	m_bLhsWeighted, m_bRhsWeighted;
+		};
+
+		bool		run(CQuBit<_T> &ans, const CQuBit<_T> &a, const CQuBit<_T> &b, cbOperation cb, cbCondOperation cc)
+					{
+					size_t n = a.GetCount(), m = b.GetCount(), iShards = GetWorkers(), i;
+					vector<CQuBit<_T> > parts;
+					bool bOk = true;
+
+						m_iFailed = m_iLocal = 0;
+						ans = CQuBit<_T>();
+						if (iShards > n)
+							iShards = n;
+#ifdef QUBIT_SHARD_FORK
+						if (iShards > 1 && (double)n*m >= QUBIT_SHARD_GRAIN && !a.HasTolerance() && !b.HasTolerance() &&
+							a.GetType() != CQuBit<_T>::eCollapsedResult && b.GetType() != CQuBit<_T>::eCollapsedResult)
+							{
+							parts.resize(iShards);
+							bOk = run_workers(parts, a, b, cb, cc);
+							}
+#endif
+						if (parts.empty())
+							{
+							evaluate(ans, a, b, cb, cc);
+							return true;
+							}
+						if (!bOk)
+							return false;
+
+						if (cb)
+							merge_oper(ans, a, b, parts);
+						else
+							{
+							for(i=0;i<parts.size();i++)
+								ans.m_Eigenstates.insert(ans.m_Eigenstates.end(),
+														 parts[i].m_Eigenstates.begin(), parts[i].m_Eigenstates.end());
+							ans.SetType(CQuBit<_T>::eCollapsedResult);
+							ans.m_eEigenType = a.GetType();
+							ans.m_bResult = (a.GetType() == CQuBit<_T>::eConj && ans.m_Eigenstates.size() == n) ||
+											(a.GetType() == CQuBit<_T>::eDisj && ans.m_Eigenstates.size());
+							}
+						return true;
+					}
+
+		/* Runs hold distinct states, so only states already kept from earlier runs can repeat */
+		void		merge_oper(CQuBit<_T> &ans, const CQuBit<_T> &a, const CQuBit<_T> &b, vector<CQuBit<_T> > &parts)
+					{
+					bool bWeighted = a.IsWeighted() || b.IsWeighted();
+					double fStates = 0;
+					size_t i, j;
+
+						for(i=0;i<parts.size();i++)
+							fStates += parts[i].GetCount();
+						ans.m_Plan = ans.plan_generate(eQuKindOper, a.GetCount(), b.GetCount(), fStates, -1, bWeighted, false);
+						ans.Reserve((size_t)fStates);
+						{
+						typename CQuBit<_T>::CQuAdder add(ans, ans.m_Plan, bWeighted, _T(), _T(), fStates);
+
+							for(i=0;i<parts.size();i++)
+								for(j=0;j<parts[i].GetCount();j++)
+									add(parts[i].m_qList[j], parts[i].GetWeight(j));
+						}
+						ans.SetType(a.GetType());
+					}
+
+		/* The rows of shard i of iShards, out of n */
+		static void	bounds(size_t i, size_t iShards, size_t n, size_t &iBegin, size_t &iEnd)
+					{
+						iBegin = n / iShards * i + (i < n % iShards ? i : n % iShards);
+						iEnd = iBegin + n / iShards + (i < n % iShards ? 1 : 0);
+					}
+
+		/* rows against all of b, just as the caller would */
+		static void	evaluate(CQuBit<_T> &part, const CQuBit<_T> &rows, const CQuBit<_T> &b, cbOperation cb, cbCondOperation cc)
+					{
+						if (cb)
+							part.do_oper(rows, b, cb);
+						else
+							part.do_condition(rows, b, cc);
+					}
+		static void	slice(CQuBit<_T> &rows, const _T *pStates, const double *pWeights, size_t iBegin, size_t iEnd, tQuSuper eType)
+					{
+						rows.m_qList.assign(pStates + iBegin, pStates + iEnd);
+						if (pWeights)
+							rows.m_qWeights.assign(pWeights + iBegin, pWeights + iEnd);
+						rows.SetType(eType);
+					}
+
+#ifdef QUBIT_SHARD_FORK
+		static size_t operand_bytes(size_t n, size_t m, bool bLhsWeighted, bool bRhsWeighted)
+					{
+						return sizeof(CQuShardHeader) + ((bLhsWeighted ? n : 0) + (bRhsWeighted ? m : 0))*sizeof(double) +
+							   (n + m)*sizeof(_T);
+					}
+		static void	segment_name(char *pName, size_t iLength)
+					{
+					static atomic<unsigned> iNext(0);
+
+						snprintf(pName, iLength, "/qubit.%ld.%u", (long)getpid(), iNext++);
+					}
+
+		/* A new segment of iBytes, mapped read/write */
+		static void *create_segment(const char *pName, size_t iBytes)
+					{
+					void *p;
+					int fd;
+
+						fd = shm_open(pName, O_CREAT | O_EXCL | O_RDWR, 0600);
+						if (fd < 0)
+							return NULL;
+						if (ftruncate(fd, (off_t)iBytes) != 0)
+							{
+							close(fd);
+							shm_unlink(pName);
+							return NULL;
+							}
+						p = mmap(NULL, iBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+						close(fd);
+						if (p == MAP_FAILED)
+							{
+							shm_unlink(pName);
+							return NULL;
+							}
+						return p;
+					}
+
+		bool		run_workers(vector<CQuBit<_T> > &parts, const CQuBit<_T> &a, const CQuBit<_T> &b,
+								cbOperation cb, cbCondOperation cc)
+					{
+					size_t n = a.GetCount(), m = b.GetCount(), iBytes, i;
+					bool bLhsWeighted = a.IsWeighted(), bRhsWeighted = b.IsWeighted();
+					char szName[64];
+					CQuShardHeader *pHeader;
+					double *pWeights;
+					_T *pStates;
+					void *pSegment;
+					vector<size_t> tries(parts.size(), 0);
+					vector<bool> done(parts.size(), false);
+					bool bOk = true, bPending = true;
+
+						/* the operands, shared with every worker. The name is only needed to open it. */
+						segment_name(szName, sizeof(szName));
+						iBytes = operand_bytes(n, m, bLhsWeighted, bRhsWeighted);
+						pSegment = create_segment(szName, iBytes);
+						if (!pSegment)
+							{
+							parts.clear();
+							return true;
+							}
+						shm_unlink(szName);
+
+						pHeader = (CQuShardHeader *)pSegment;
+						pHeader->m_iMagic = QUBIT_SHARD_MAGIC;
+						pHeader->m_iLhs = n;
+						pHeader->m_iRhs = m;
+						pHeader->m_eLhs = a.GetType();
+						pHeader->m_eRhs = b.GetType();
+						pHeader->m_bLhsWeighted = bLhsWeighted;
+						pHeader->m_bRhsWeighted = bRhsWeighted;
+						pWeights = (double *)(pHeader + 1);
+						if (bLhsWeighted)
+							memcpy(pWeights, a.m_qWeights.data(), n*sizeof(double));
+						if (bRhsWeighted)
+							memcpy(pWeights + (bLhsWeighted ? n : 0), b.m_qWeights.data(), m*sizeof(double));
+						pStates = (_T *)(pWeights + (bLhsWeighted ? n : 0) + (bRhsWeighted ? m : 0));
+						memcpy(pStates, a.m_qList.data(), n*sizeof(_T));
+						memcpy(pStates + n, b.m_qList.data(), m*sizeof(_T));
+
+						/* each round starts a worker for every outstanding run, then collects them in order */
+						while(bPending)
+							{
+							vector<string> names(parts.size());
+							vector<pid_t> pids(parts.size(), -1);
+							tQuClock tEnd = tQuClock::clock::now() + chrono::duration_cast<tQuClock::duration>(chrono::duration<double>(m_fTimeout));
+
+							bPending = false;
+							for(i=0;i<parts.size();i++)
+								if (!done[i] && tries[i] <= QUBIT_SHARD_RETRIES)
+									{
+									segment_name(szName, sizeof(szName));
+									pids[i] = start_worker(pHeader, i, parts.size(), szName, cb, cc);
+									if (pids[i] > 0)
+										names[i] = szName;
+									else
+										{
+										m_iLocal++;
+										local(parts[i], pHeader, i, parts.size(), cb, cc);
+										done[i] = true;
+										}
+									}
+							for(i=0;i<parts.size();i++)
+								if (pids[i] > 0)
+									{
+									done[i] = collect(parts[i], pids[i], names[i].c_str(), cb, m_fTimeout > 0 ? &tEnd : NULL);
+									if (done[i])
+										continue;
+									m_iFailed++;
+									if (++tries[i] <= QUBIT_SHARD_RETRIES)
+										bPending = true;
+									else
+										bOk = false;
+									}
+							}
+
+						munmap(pSegment, iBytes);
+						return bOk;
+					}
+
+		/* Shard i of the operands in the segment, in this process */
+		static void	local(CQuBit<_T> &part, const CQuShardHeader *pHeader, size_t i, size_t iShards,
+						  cbOperation cb, cbCondOperation cc)
+					{
+					size_t n = pHeader->m_iLhs, m = pHeader->m_iRhs, iBegin, iEnd;
+					const double *pWeights = (const double *)(pHeader + 1);
+					const _T *pStates = (const _T *)(pWeights + (pHeader->m_bLhsWeighted ? n : 0) +
+													 (pHeader->m_bRhsWeighted ? m : 0));
+					CQuBit<_T> rows, b;
+
+						bounds(i, iShards, n, iBegin, iEnd);
+						slice(rows, pStates, pHeader->m_bLhsWeighted ? pWeights : NULL, iBegin, iEnd, (tQuSuper)pHeader->m_eLhs);
+						slice(b, pStates + n, pHeader->m_bRhsWeighted ? pWeights + (pHeader->m_bLhsWeighted ? n : 0) : NULL,
+							  0, m, (tQuSuper)pHeader->m_eRhs);
+						evaluate(part, rows, b, cb, cc);
+					}
+
+		/* Forks a worker for shard i, which leaves its results in the segment pName */
+		static pid_t start_worker(const CQuShardHeader *pHeader, size_t i, size_t iShards, const char *pName,
+								  cbOperation cb, cbCondOperation cc)
+					{
+					pid_t pid = fork();
+
+						if (pid != 0)
+							return pid;
+
+						/* the worker. Its runs are the parallelism, so it uses no threads of its own. */
+						QuSetThreadCount(1);
+						{
+						CQuBit<_T> part;
+						const tQuStates &states = cb ? part.m_qList : part.m_Eigenstates;
+						bool bWeighted;
+						size_t iBytes;
+						CQuShardHeader *pOut;
+						double *pWeights;
+
+							local(part, pHeader, i, iShards, cb, cc);
+							bWeighted = cb && part.IsWeighted();
+							iBytes = sizeof(CQuShardHeader) + states.size()*((bWeighted ? sizeof(double) : 0) + sizeof(_T));
+							pOut = (CQuShardHeader *)create_segment(pName, iBytes);
+							if (!pOut)
+								_exit(1);
+
+							pOut->m_iLhs = states.size();
+							pOut->m_iRhs = 0;
+							pOut->m_bLhsWeighted = bWeighted;
+							pWeights = (double *)(pOut + 1);
+							if (bWeighted)
+								memcpy(pWeights, part.m_qWeights.data(), states.size()*sizeof(double));
+							memcpy(bWeighted ? (void *)(pWeights + states.size()) : (void *)pWeights,
+								   states.data(), states.size()*sizeof(_T));
+							pOut->m_iMagic = QUBIT_SHARD_MAGIC;
+							munmap(pOut, iBytes);
+						}
+						/* without running the caller's destructors or atexit handlers */
+						_exit(0);
+					}
+
+		/* Waits for a worker until *pEnd (if given), and reaps it. False if it did not
+		   exit cleanly in time, in which case it is killed. */
+		static bool	wait_worker(pid_t pid, const tQuClock *pEnd, int &iStatus)
+					{
+					int iSleep = 1;
+					pid_t r;
+
+						for(;;)
+							{
+							r = waitpid(pid, &iStatus, WNOHANG);
+							if (r == pid)
+								return WIFEXITED(iStatus) && WEXITSTATUS(iStatus) == 0;
+							if (r < 0 && errno != EINTR)
+								return false;
+							if ((pEnd && tQuClock::clock::now() >= *pEnd) || QuProgressPoll())
+								break;
+							this_thread::sleep_for(chrono::milliseconds(iSleep));
+							if (iSleep < QUBIT_SHARD_POLL_MAX)
+								iSleep *= 2;
+							}
+
+						/* hung, or no longer wanted */
+						kill(pid, SIGKILL);
+						while(waitpid(pid, &iStatus, 0) < 0 && errno == EINTR)
+							;
+						return false;
+					}
+
+		/* Waits for a worker, and takes its results. False if it did not finish cleanly. */
+		static bool	collect(CQuBit<_T> &part, pid_t pid, const char *pName, cbOperation cb, const tQuClock *pEnd)
+					{
+					const CQuShardHeader *pIn = NULL;
+					const double *pWeights;
+					const _T *pStates;
+					struct stat st;
+					size_t iCount = 0;
+					int iStatus = 0, fd;
+					bool bOk;
+
+						bOk = wait_worker(pid, pEnd, iStatus);
+
+						fd = bOk ? shm_open(pName, O_RDONLY, 0) : -1;
+						shm_unlink(pName);
+						if (fd < 0)
+							return false;
+
+						/* the size must agree with the count, or the worker did not finish writing */
+						bOk = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(CQuShardHeader);
+						if (bOk)
+							{
+							pIn = (const CQuShardHeader *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+							bOk = pIn != MAP_FAILED;
+							}
+						close(fd);
+						if (!bOk)
+							return false;
+
+						iCount = pIn->m_iLhs;
+						bOk = pIn->m_iMagic == QUBIT_SHARD_MAGIC &&
+							  (size_t)st.st_size == sizeof(CQuShardHeader) + iCount*((pIn->m_bLhsWeighted ? sizeof(double) : 0) + sizeof(_T));
+						if (bOk)
+							{
+							pWeights = (const double *)(pIn + 1);
+							pStates = (const _T *)(pWeights + (pIn->m_bLhsWeighted ? iCount : 0));
+							if (cb)
+								slice(part, pStates, pIn->m_bLhsWeighted ? pWeights : NULL, 0, iCount, CQuBit<_T>::eConj);
+							else
+								{
+								part.m_Eigenstates.assign(pStates, pStates + iCount);
+								part.SetType(CQuBit<_T>::eCollapsedResult);
+								}
+							}
+						munmap((void *)pIn, st.st_size);
+						return bOk;
+					}
+#endif	// QUBIT_SHARD_FORK
+
+		size_t			m_iWorkers;
+		double			m_fTimeout;		/* seconds, or 0 */
+		size_t			m_iFailed;
+		size_t			m_iLocal;
+};
+
+
+#endif	// QUSHARD_H
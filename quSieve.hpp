@@ -0,0 +1,72 @@
+#ifndef QUSIEVE_H
+#define QUSIEVE_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Factor and primality engine
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <vector>
+#include <atomic>
+#include <shared_mutex>
+#include <stdint.h>
+
+using namespace std;
+
+/* Numbers above this are answered by trial division, rather than growing the
+   table. At 4 bytes a number, the default table tops out at 16MB. */
+#ifndef QUBIT_SIEVE_MAX
+#define QUBIT_SIEVE_MAX		(1u<<22)
+#endif
+/* The smallest table allowed, which holds every prime trial division needs */
+#define QUBIT_SIEVE_MIN		(1u<<17)
+/* The sieve is extended a segment of this many numbers at a time */
+#define QUBIT_SIEVE_SEGMENT	32768
+
+
+/*
+** A smallest-prime-factor table, grown on demand a segment at a time.
+** Any number of threads may query it at once; the first thread to ask
+** beyond the current limit extends it for everyone. The table only grows
+** to GetMaxLimit(); SetMaxLimit and Release give memory back.
+*/
+class CQuSieve {
+
+	public:
+		CQuSieve();
+
+		static CQuSieve &Get(void);			/* the engine shared by quSample */
+
+		void		Reserve(uint32_t n);	/* make sure 0..n are in the table */
+		uint32_t	GetLimit(void) const	{ return m_iLimit; }
+		/* Caps the table at iMax numbers (at least QUBIT_SIEVE_MIN), cutting it back if it is larger */
+		void		SetMaxLimit(uint32_t iMax);
+		uint32_t	GetMaxLimit(void) const	{ return m_iMax; }
+		/* Frees the table. It is built again as it is needed. */
+		void		Release(void);
+
+		bool		IsPrime(uint32_t n);
+		uint32_t	SmallestFactor(uint32_t n);
+		/* prime factors, with their multiplicity, in ascending order */
+		void		Factorise(uint32_t n, vector<uint32_t> &primes, vector<uint32_t> &powers);
+		/* every divisor (including 1 and n), in ascending order */
+		void		Divisors(uint32_t n, vector<uint32_t> &divisors);
+
+	private:
+		void		Extend(uint32_t n);
+		void		Truncate(uint32_t iLimit);
+		void		SieveSegment(uint32_t iLo, uint32_t iHi);
+		uint32_t	TrialFactor(uint32_t n);
+
+		vector<uint32_t>	m_Spf;			/* smallest prime factor of every i < m_iLimit */
+		vector<uint32_t>	m_Primes;		/* every prime < m_iLimit */
+		atomic<uint32_t>	m_iLimit;
+		atomic<uint32_t>	m_iMax;
+		shared_mutex		m_Lock;
+};
+
+
+#endif	// QUSIEVE_H
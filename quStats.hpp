@@ -0,0 +1,288 @@
+#ifndef QUSTATS_H
+#define QUSTATS_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Operation counters and memory accounting
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <iostream>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <stdint.h>
+#include "quCache.hpp"
+#include "quPerf.hpp"
+
+using namespace std;
+
+
+/*
+** Define QUBIT_STATS (before including quBit.hpp, and the same in every
+** file) to count what each kind of operation does, how long it takes, and
+** the memory held by states. Without it, every hook compiles away and the
+** snapshot is all zeros.
+**
+** e.g.
+**	CQuBitStats::Reset();
+**	slow_expression();
+**	cout << CQuBitStats::Snapshot();
+**
+** The counters are process-wide, and may be updated from any thread.
+**
+** Also defining QUBIT_PERF reads the hardware counters of quPerf.hpp around
+** each operation, so cache and branch misses can be told apart from time
+** spent elsewhere. The counts include the worker threads an operation runs
+** its chunks on. This costs a few system calls per operation.
+*/
+struct CQuBitStats {
+
+	struct CQuKindStats {
+		uint64_t	m_iCalls;
+		uint64_t	m_iElements;		/* operand states (or pairs of states) visited */
+		uint64_t	m_iNanoseconds;		/* wall time, including any nested operations */
+		CQuPerfSample	m_Perf;			/* likewise, under QUBIT_PERF */
+	};
+
+	CQuKindStats	m_Kinds[eQuKindCount];	/* by tQuKind */
+
+	/* Add and AddWeighted */
+	uint64_t		m_iAdds;
+	uint64_t		m_iAddCompares;		/* states compared in searching for a duplicate */
+	uint64_t		m_iAddRejects;		/* duplicates not added */
+
+	/* states and eigenstates */
+	uint64_t		m_iAllocations;
+	uint64_t		m_iBytesAllocated;	/* in total */
+	uint64_t		m_iBytesLive;
+	uint64_t		m_iBytesPeak;		/* since the last Reset */
+
+	static bool			IsEnabled(void)
+						{
+#ifdef QUBIT_STATS
+							return true;
+#else
+							return false;
+#endif
+						}
+	static CQuBitStats	Snapshot(void);
+	static void			Reset(void);
+	static const char *	GetKindName(tQuKind eKind)
+						{
+						static const char *pNames[eQuKindCount] = {
+							"oper", "oper_type", "type_oper", "unary", "incdec",
+							"condition", "condition_type", "oper_int", "set_any", "set_all", "where", };
+
+							return eKind < eQuKindCount ? pNames[eKind] : "";
+						}
+
+	friend  ostream &operator<<(ostream &os, const CQuBitStats &s)
+				{
+				int i;
+
+					for(i=0;i<eQuKindCount;i++)
+						if (s.m_Kinds[i].m_iCalls)
+							{
+							os << GetKindName((tQuKind)i) << ": " << s.m_Kinds[i].m_iCalls << " calls, "
+							   << s.m_Kinds[i].m_iElements << " elements, "
+							   << s.m_Kinds[i].m_iNanoseconds/1e6 << " ms" << endl;
+							if (s.m_Kinds[i].m_Perf.m_iCount[eQuPerfCycles])
+								os << "  " << s.m_Kinds[i].m_Perf << endl;
+							}
+					os << "add: " << s.m_iAdds << " calls, " << s.m_iAddCompares << " compares, "
+					   << s.m_iAddRejects << " duplicates" << endl;
+					os << "memory: " << s.m_iAllocations << " allocations, " << s.m_iBytesAllocated
+					   << " bytes, " << s.m_iBytesLive << " live, " << s.m_iBytesPeak << " peak" << endl;
+					return os;
+				}
+};
+
+
+#ifdef QUBIT_STATS
+
+/*
+** The live counters, from which snapshots are taken
+*/
+struct CQuStatsCounters {
+	atomic<uint64_t>	m_iCalls[eQuKindCount];
+	atomic<uint64_t>	m_iElements[eQuKindCount];
+	atomic<uint64_t>	m_iNanoseconds[eQuKindCount];
+#ifdef QUBIT_PERF
+	atomic<uint64_t>	m_iPerf[eQuKindCount][eQuPerfCount];
+#endif
+	atomic<uint64_t>	m_iAdds, m_iAddCompares, m_iAddRejects;
+	atomic<uint64_t>	m_iAllocations, m_iBytesAllocated, m_iBytesLive, m_iBytesPeak;
+
+	static CQuStatsCounters &Get(void)
+				{
+				static CQuStatsCounters counters;
+
+					return counters;
+				}
+	void	Reset(void)
+				{
+				int i;
+
+					for(i=0;i<eQuKindCount;i++)
+						{
+						m_iCalls[i] = m_iElements[i] = m_iNanoseconds[i] = 0;
+#ifdef QUBIT_PERF
+						for(int j=0;j<eQuPerfCount;j++)
+							m_iPerf[i][j] = 0;
+#endif
+						}
+					m_iAdds = m_iAddCompares = m_iAddRejects = 0;
+					m_iAllocations = m_iBytesAllocated = 0;
+					m_iBytesPeak = m_iBytesLive.load();
+				}
+
+	CQuStatsCounters()		{ m_iBytesLive = 0; Reset(); }
+};
+
+inline CQuBitStats CQuBitStats::Snapshot(void)
+{
+CQuStatsCounters &c = CQuStatsCounters::Get();
+CQuBitStats s;
+int i;
+
+	for(i=0;i<eQuKindCount;i++)
+		{
+		s.m_Kinds[i].m_iCalls = c.m_iCalls[i].load(memory_order_relaxed);
+		s.m_Kinds[i].m_iElements = c.m_iElements[i].load(memory_order_relaxed);
+		s.m_Kinds[i].m_iNanoseconds = c.m_iNanoseconds[i].load(memory_order_relaxed);
+#ifdef QUBIT_PERF
+		for(int j=0;j<eQuPerfCount;j++)
+			s.m_Kinds[i].m_Perf.m_iCount[j] = c.m_iPerf[i][j].load(memory_order_relaxed);
+#endif
+		}
+	s.m_iAdds = c.m_iAdds.load(memory_order_relaxed);
+	s.m_iAddCompares = c.m_iAddCompares.load(memory_order_relaxed);
+	s.m_iAddRejects = c.m_iAddRejects.load(memory_order_relaxed);
+	s.m_iAllocations = c.m_iAllocations.load(memory_order_relaxed);
+	s.m_iBytesAllocated = c.m_iBytesAllocated.load(memory_order_relaxed);
+	s.m_iBytesLive = c.m_iBytesLive.load(memory_order_relaxed);
+	s.m_iBytesPeak = c.m_iBytesPeak.load(memory_order_relaxed);
+	return s;
+}
+
+inline void CQuBitStats::Reset(void)	{ CQuStatsCounters::Get().Reset(); }
+
+
+/* Times one operation, from construction to the end of its scope */
+class CQuStatsScope {
+
+	public:
+		CQuStatsScope(tQuKind eKind, uint64_t iElements) : m_eKind(eKind), m_Start(chrono::steady_clock::now())
+					{
+					CQuStatsCounters &c = CQuStatsCounters::Get();
+
+						c.m_iCalls[eKind].fetch_add(1, memory_order_relaxed);
+						c.m_iElements[eKind].fetch_add(iElements, memory_order_relaxed);
+#ifdef QUBIT_PERF
+						CQuPerfCounters::Local().Read(m_PerfStart);
+#endif
+					}
+		~CQuStatsScope()
+					{
+					uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - m_Start).count();
+
+						CQuStatsCounters::Get().m_iNanoseconds[m_eKind].fetch_add(ns, memory_order_relaxed);
+#ifdef QUBIT_PERF
+						record_perf();
+#endif
+					}
+
+	private:
+#ifdef QUBIT_PERF
+		void		record_perf(void)
+					{
+					CQuStatsCounters &c = CQuStatsCounters::Get();
+					CQuPerfSample end;
+					int i;
+
+						CQuPerfCounters::Local().Read(end);
+						end = end - m_PerfStart;
+						for(i=0;i<eQuPerfCount;i++)
+							c.m_iPerf[m_eKind][i].fetch_add(end.m_iCount[i], memory_order_relaxed);
+					}
+
+		CQuPerfSample					m_PerfStart;
+#endif
+		tQuKind							m_eKind;
+		chrono::steady_clock::time_point	m_Start;
+};
+
+inline void QuStatsAdd(uint64_t iCompares, bool bRejected)
+{
+CQuStatsCounters &c = CQuStatsCounters::Get();
+
+	c.m_iAdds.fetch_add(1, memory_order_relaxed);
+	c.m_iAddCompares.fetch_add(iCompares, memory_order_relaxed);
+	if (bRejected)
+		c.m_iAddRejects.fetch_add(1, memory_order_relaxed);
+}
+
+
+/*
+** Allocator for the states of a CQuBit, which keeps the byte counts
+*/
+template <typename _T>
+class CQuAllocator {
+
+	public:
+		typedef _T value_type;
+
+		CQuAllocator()	{}
+		template <typename _U>
+		CQuAllocator(const CQuAllocator<_U> &)	{}
+
+		_T *		allocate(size_t n)
+					{
+					CQuStatsCounters &c = CQuStatsCounters::Get();
+					uint64_t iBytes = n * sizeof(_T);
+					uint64_t iLive = c.m_iBytesLive.fetch_add(iBytes, memory_order_relaxed) + iBytes;
+					uint64_t iPeak = c.m_iBytesPeak.load(memory_order_relaxed);
+
+						c.m_iAllocations.fetch_add(1, memory_order_relaxed);
+						c.m_iBytesAllocated.fetch_add(iBytes, memory_order_relaxed);
+						while(iLive > iPeak && !c.m_iBytesPeak.compare_exchange_weak(iPeak, iLive, memory_order_relaxed))
+							;
+						return allocator<_T>().allocate(n);
+					}
+		void		deallocate(_T *p, size_t n)
+					{
+						CQuStatsCounters::Get().m_iBytesLive.fetch_sub(n * sizeof(_T), memory_order_relaxed);
+						allocator<_T>().deallocate(p, n);
+					}
+
+		template <typename _U>
+		bool		operator==(const CQuAllocator<_U> &) const	{ return true; }
+		template <typename _U>
+		bool		operator!=(const CQuAllocator<_U> &) const	{ return false; }
+};
+
+#define QUBIT_STATS_SCOPE(kind, elements)	CQuStatsScope quStatsScope((kind), (elements))
+#define QUBIT_STATS_ADD(compares, rejected)	QuStatsAdd((compares), (rejected))
+
+#else	// QUBIT_STATS
+
+inline CQuBitStats CQuBitStats::Snapshot(void)
+{
+	return CQuBitStats();
+}
+
+inline void CQuBitStats::Reset(void)	{}
+
+template <typename _T> using CQuAllocator = allocator<_T>;
+
+#define QUBIT_STATS_SCOPE(kind, elements)
+#define QUBIT_STATS_ADD(compares, rejected)
+
+#endif	// QUBIT_STATS
+
+
+#endif	// QUSTATS_H
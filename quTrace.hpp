@@ -0,0 +1,274 @@
+#ifndef QUTRACE_H
+#define QUTRACE_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Timeline tracing, in Chrome trace-event format
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <string>
+#include <cstdio>
+#include <type_traits>
+#include <stdint.h>
+
+using namespace std;
+
+/* Spans kept per thread; once full, the oldest are overwritten */
+#ifndef QUBIT_TRACE_BUFFER
+#define QUBIT_TRACE_BUFFER	16384
+#endif
+
+
+/*
+** Define QUBIT_TRACE (before including quBit.hpp, and the same in every
+** file) to record a span for every operation, condition, set operation,
+** stream I/O and parallel chunk, with the sizes of its operands and result.
+** CQuTrace::Save then writes them as trace-event JSON, which can be loaded
+** into Perfetto (ui.perfetto.dev) or chrome://tracing.
+**
+** Each thread records into its own ring buffer without locking. Worker
+** threads are short-lived, so when one ends its buffer is handed to the
+** next thread to start; each buffer appears as one track in the timeline.
+** Save and Clear must not be called while operations are running.
+*/
+struct CQuTraceSpan {
+	const char *	m_pName;
+	uint64_t		m_iStart;		/* ns, since tracing began */
+	uint64_t		m_iDuration;
+	uint64_t		m_iLhs;			/* operand sizes */
+	uint64_t		m_iRhs;
+	uint64_t		m_iResult;
+	size_t			m_iThread;		/* hash of the thread's id, as 32 bits for JSON */
+};
+
+class CQuTraceBuffer {
+
+	public:
+		CQuTraceBuffer(size_t iTrack) : m_Spans(QUBIT_TRACE_BUFFER), m_iTrack(iTrack) { m_iCount = 0; }
+
+		/* Only ever called by the thread that owns the buffer */
+		void		Record(const CQuTraceSpan &span)
+					{
+					uint64_t i = m_iCount.load(memory_order_relaxed);
+
+						m_Spans[i % m_Spans.size()] = span;
+						m_iCount.store(i+1, memory_order_release);
+					}
+
+		/* The spans still held, oldest first */
+		void		Get(vector<CQuTraceSpan> &spans) const
+					{
+					uint64_t iCount = m_iCount.load(memory_order_acquire);
+					uint64_t i = iCount > m_Spans.size() ? iCount - m_Spans.size() : 0;
+
+						for(;i<iCount;i++)
+							spans.push_back(m_Spans[i % m_Spans.size()]);
+					}
+		void		Clear(void)					{ m_iCount = 0; }
+inline	size_t		GetTrack(void) const		{ return m_iTrack; }
+
+	private:
+		vector<CQuTraceSpan>	m_Spans;
+		atomic<uint64_t>		m_iCount;		/* spans ever recorded */
+		size_t					m_iTrack;
+};
+
+
+class CQuTrace {
+
+	public:
+		static CQuTrace &Get(void)
+					{
+					static CQuTrace trace;
+
+						return trace;
+					}
+
+		static bool	IsEnabled(void)
+					{
+#ifdef QUBIT_TRACE
+						return true;
+#else
+						return false;
+#endif
+					}
+
+		/* ns since tracing began */
+		uint64_t	Now(void) const
+					{
+						return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - m_Start).count();
+					}
+
+		/* The calling thread's buffer */
+		CQuTraceBuffer &Local(void)
+					{
+					static thread_local CQuTraceLease lease;
+
+						if (!lease.m_pBuffer)
+							lease.m_pBuffer = Acquire();
+						return *lease.m_pBuffer;
+					}
+
+		void		Write(ostream &os)
+					{
+					lock_guard<mutex> lock(m_Lock);
+					vector<CQuTraceSpan> spans;
+					size_t i, j;
+					bool bFirst = true;
+
+						os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+						for(i=0;i<m_Buffers.size();i++)
+							{
+							os << (bFirst ? "" : ",\n");
+							bFirst = false;
+							os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << m_Buffers[i]->GetTrack()
+							   << ",\"args\":{\"name\":\"qubit " << m_Buffers[i]->GetTrack() << "\"}}";
+
+							spans.clear();
+							m_Buffers[i]->Get(spans);
+							for(j=0;j<spans.size();j++)
+								{
+								const CQuTraceSpan &s = spans[j];
+
+								os << ",\n{\"name\":\"" << s.m_pName << "\",\"cat\":\"qubit\",\"ph\":\"X\",\"pid\":1"
+								   << ",\"tid\":" << m_Buffers[i]->GetTrack()
+								   << ",\"ts\":" << micro(s.m_iStart) << ",\"dur\":" << micro(s.m_iDuration)
+								   << ",\"args\":{\"lhs\":" << s.m_iLhs << ",\"rhs\":" << s.m_iRhs
+								   << ",\"result\":" << s.m_iResult << ",\"thread\":" << s.m_iThread << "}}";
+								}
+							}
+						os << "\n]}\n";
+					}
+		bool		Save(const char *pFile)
+					{
+					ofstream os(pFile);
+
+						if (!os)
+							return false;
+						Write(os);
+						return (bool)os;
+					}
+		void		Clear(void)
+					{
+					lock_guard<mutex> lock(m_Lock);
+					size_t i;
+
+						for(i=0;i<m_Buffers.size();i++)
+							m_Buffers[i]->Clear();
+					}
+
+	private:
+		CQuTrace() : m_Start(chrono::steady_clock::now()) {}
+
+		/* Trace times are in microseconds, here to the ns */
+		static string micro(uint64_t iNs)
+					{
+					char sz[32];
+
+						snprintf(sz, sizeof(sz), "%llu.%03u", (unsigned long long)(iNs/1000), (unsigned)(iNs%1000));
+						return sz;
+					}
+
+		/* A thread's hold on a buffer, which it gives back when it ends */
+		struct CQuTraceLease {
+			CQuTraceLease() : m_pBuffer(NULL) {}
+			~CQuTraceLease()	{ if (m_pBuffer) CQuTrace::Get().Release(m_pBuffer); }
+
+			CQuTraceBuffer *	m_pBuffer;
+		};
+
+		CQuTraceBuffer *Acquire(void)
+					{
+					lock_guard<mutex> lock(m_Lock);
+					CQuTraceBuffer *pBuffer;
+
+						if (!m_Free.empty())
+							{
+							pBuffer = m_Free.back();
+							m_Free.pop_back();
+							return pBuffer;
+							}
+						m_Buffers.push_back(unique_ptr<CQuTraceBuffer>(new CQuTraceBuffer(m_Buffers.size()+1)));
+						return m_Buffers.back().get();
+					}
+		void		Release(CQuTraceBuffer *pBuffer)
+					{
+					lock_guard<mutex> lock(m_Lock);
+
+						m_Free.push_back(pBuffer);
+					}
+
+		chrono::steady_clock::time_point	m_Start;
+		vector<unique_ptr<CQuTraceBuffer> >	m_Buffers;
+		vector<CQuTraceBuffer *>			m_Free;
+		mutex								m_Lock;
+};
+
+
+#ifdef QUBIT_TRACE
+
+/* Records one span, from construction to the end of its scope */
+class CQuTraceScope {
+
+	public:
+		CQuTraceScope(const char *pName, uint64_t iLhs, uint64_t iRhs)
+					{
+						m_Span.m_pName = pName;
+						m_Span.m_iLhs = iLhs;
+						m_Span.m_iRhs = iRhs;
+						m_Span.m_iResult = 0;
+						m_Span.m_iStart = CQuTrace::Get().Now();
+					}
+		~CQuTraceScope()
+					{
+						m_Span.m_iDuration = CQuTrace::Get().Now() - m_Span.m_iStart;
+						m_Span.m_iThread = hash<thread::id>()(this_thread::get_id()) & 0xffffffff;
+						CQuTrace::Get().Local().Record(m_Span);
+					}
+
+	protected:
+		CQuTraceSpan	m_Span;
+};
+
+/* As CQuTraceScope, also noting the size of a superposition as its result */
+template <typename _Q>
+class CQuTraceResultScope : public CQuTraceScope {
+
+	public:
+		CQuTraceResultScope(const char *pName, uint64_t iLhs, uint64_t iRhs, const _Q *pResult)
+					: CQuTraceScope(pName, iLhs, iRhs), m_pResult(pResult) {}
+		~CQuTraceResultScope()
+					{
+						m_Span.m_iResult = m_pResult->GetCount() + m_pResult->GetEigenCount();
+					}
+
+	private:
+		const _Q *	m_pResult;
+};
+
+#define QUBIT_TRACE_SCOPE(name, lhs, rhs)				CQuTraceScope quTraceScope((name), (lhs), (rhs))
+#define QUBIT_TRACE_RESULT(name, lhs, rhs, result)		\
+			CQuTraceResultScope<typename remove_cv<typename remove_pointer<decltype(result)>::type>::type> \
+				quTraceScope((name), (lhs), (rhs), (result))
+
+#else	// QUBIT_TRACE
+
+#define QUBIT_TRACE_SCOPE(name, lhs, rhs)
+#define QUBIT_TRACE_RESULT(name, lhs, rhs, result)
+
+#endif	// QUBIT_TRACE
+
+
+#endif	// QUTRACE_H
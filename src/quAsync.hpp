@@ -0,0 +1,123 @@
+#ifndef QUASYNC_H
+#define QUASYNC_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Asynchronous evaluation, with cancellation and progress
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <future>
+#include <string>
+#include <sstream>
+#include "quBit.hpp"
+
+using namespace std;
+
+
+/*
+** Runs fn() on a thread of its own, as the job 'progress' (see quThread.hpp),
+** so the caller can go on with other work, watch progress.GetFraction(), and
+** Cancel() it or give it a deadline. 'progress' must outlive the job, e.g.
+**	CQuProgress progress;
+**	progress.SetDeadline(2.0);
+**	future<CQuBit<int> > f = CQuAsync<int>::Oper(progress, a, eQuOpMul, b);
+**	...
+**	CQuBit<int> product = f.get();
+**	if (progress.IsCancelled())
+**		...
+*/
+template <typename _F>
+auto QuAsync(CQuProgress &progress, _F fn) -> future<decltype(fn())>
+{
+	return async(launch::async, [&progress, fn]() mutable
+		{
+		CQuProgressScope scope(progress);
+
+			return fn();
+		});
+}
+
+
+/*
+** The heavy operations, run through QuAsync. The operands are taken by value,
+** so the caller may change (or std::move) its own as soon as the call
+** returns. A cancelled job's superposition is empty.
+*/
+template <typename _T>
+class CQuAsync {
+
+	public:
+		/* a OP b */
+		static future<CQuBit<_T> >	Oper(CQuProgress &progress, CQuBit<_T> a, tQuOper op, CQuBit<_T> b)
+					{
+						return run(progress, [a, op, b](CQuBit<_T> &ans) { ans.do_oper(a, b, CQuBit<_T>::oper_of(op)); });
+					}
+		/* a COND b, collapsed as the expression is */
+		static future<CQuBit<_T> >	Condition(CQuProgress &progress, CQuBit<_T> a, tQuCond co, CQuBit<_T> b)
+					{
+						return run(progress, [a, co, b](CQuBit<_T> &ans) { ans.do_condition(a, b, CQuBit<_T>::cond_of(co)); });
+					}
+		/* a.Where(op, b, co, rhs) */
+		static future<CQuBit<_T> >	Where(CQuProgress &progress, CQuBit<_T> a, tQuOper op, CQuBit<_T> b, tQuCond co, _T rhs)
+					{
+						return run(progress, [a, op, b, co, rhs](CQuBit<_T> &ans) { ans.do_where(a, op, b, co, rhs); });
+					}
+
+		/* union and intersection */
+		static future<CQuBit<_T> >	Any(CQuProgress &progress, CQuBit<_T> a, CQuBit<_T> b)
+					{
+						return run(progress, [a, b](CQuBit<_T> &ans) mutable { ans = a.Any(a, b); });
+					}
+		static future<CQuBit<_T> >	All(CQuProgress &progress, CQuBit<_T> a, CQuBit<_T> b)
+					{
+						return run(progress, [a, b](CQuBit<_T> &ans) mutable { ans = a.All(a, b); });
+					}
+
+		/* Bulk loading, as CQuBit(first, last, step) */
+		static future<CQuBit<_T> >	Range(CQuProgress &progress, _T iFirst, _T iLast, float iStep = 1)
+					{
+						return run(progress, [iFirst, iLast, iStep](CQuBit<_T> &ans) { ans.AddRange(iFirst, iLast, iStep); });
+					}
+
+		/* Serialization, with operator>> and operator<< */
+		static future<CQuBit<_T> >	Read(CQuProgress &progress, string text)
+					{
+						return run(progress, [text](CQuBit<_T> &ans)
+							{
+							istringstream is(text);
+
+								is >> ans;
+							});
+					}
+		static future<string>		Write(CQuProgress &progress, CQuBit<_T> q)
+					{
+						return QuAsync(progress, [q, &progress]()
+							{
+							ostringstream os;
+
+								os << q;
+								return progress.IsCancelled() ? string() : os.str();
+							});
+					}
+
+	private:
+		template <typename _F>
+		static future<CQuBit<_T> >	run(CQuProgress &progress, _F fn)
+					{
+						return QuAsync(progress, [fn, &progress]() mutable
+							{
+							CQuBit<_T> ans;
+
+								fn(ans);
+								if (progress.IsCancelled())
+									ans = CQuBit<_T>();
+								return ans;
+							});
+					}
+};
+
+
+#endif	// QUASYNC_H
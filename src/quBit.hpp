@@ -14,15 +14,161 @@
 #include <iostream>
 #include <vector>
 #include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <cstring>
+#include <chrono>
+#include <stdint.h>
+#include "quThread.hpp"
+#include "quCache.hpp"
+#include "quStats.hpp"
+#include "quTrace.hpp"
+#include "quPlan.hpp"
+#include "quFFT.hpp"
+#include "quRandom.hpp"
+#include "quBloom.hpp"
+#include "quEstimate.hpp"
 
 using namespace std;
 
 #define QUBIT_RAND_MAX RAND_MAX
 
+/* Batch evaluation works on tiles of this many states, by this many inputs */
+#define QUBIT_BATCH_TILE	256
+#define QUBIT_BATCH_ROWS	16
+
+
+/*
+** Operator Identifiers
+** Used where the operator is chosen at run-time, rather than by overloading
+*/
+typedef enum { eQuOpAdd, eQuOpSub, eQuOpMul, eQuOpDiv, eQuOpMod, 
+			   eQuOpBand, eQuOpBor, eQuOpXor, eQuOpLand, eQuOpLor, } tQuOper;
+typedef enum { eQuCoLt, eQuCoLte, eQuCoGt, eQuCoGte, eQuCoEq, eQuCoNeq, } tQuCond;
+
+
+/*
+** Walker/Vose alias table, for drawing weighted states in O(1)
+*/
+struct CQuAlias {
+	vector<double>	m_Prob;
+	vector<size_t>	m_Alias;
+};
+
+inline void QuBuildAlias(const vector<double> &weights, CQuAlias &table)
+{
+size_t n = weights.size(), i, s, l;
+vector<size_t> small, large;
+vector<double> scaled(n);
+double fTotal = 0;
+
+	table.m_Prob.assign(n, 1.0);
+	table.m_Alias.resize(n);
+	for(i=0;i<n;i++)
+		{
+		table.m_Alias[i] = i;
+		fTotal += weights[i] > 0 ? weights[i] : 0;
+		}
+	if (fTotal <= 0)
+		return;		/* nothing to prefer, so draw uniformly */
+
+	for(i=0;i<n;i++)
+		{
+		scaled[i] = (weights[i] > 0 ? weights[i] : 0) * n / fTotal;
+		if (scaled[i] < 1.0)	small.push_back(i);
+		else					large.push_back(i);
+		}
+
+	while(!small.empty() && !large.empty())
+		{
+		s = small.back();	small.pop_back();
+		l = large.back();
+		table.m_Prob[s] = scaled[s];
+		table.m_Alias[s] = l;
+		scaled[l] -= 1.0 - scaled[s];
+		if (scaled[l] < 1.0)
+			{
+			large.pop_back();
+			small.push_back(l);
+			}
+		}
+	/* anything left over is 1, give or take rounding */
+}
+
+
+/*
+** The integral-only operators. Floating point states use their integer part
+** (as Floor() does) so that every operator exists for every CQuBit type.
+*/
+template <typename _T, bool bIntegral = is_integral<_T>::value>
+struct CQuArith {
+	static _T Mod(const _T &a, const _T &b)	{ return a%b; }
+	static _T And(const _T &a, const _T &b)	{ return a&b; }
+	static _T Or(const _T &a, const _T &b)	{ return a|b; }
+	static _T Xor(const _T &a, const _T &b)	{ return a^b; }
+	static _T Not(const _T &a)				{ return ~a; }
+	static _T Shl(const _T &a, int i)		{ return a<<i; }
+	static _T Shr(const _T &a, int i)		{ return a>>i; }
+};
+
+template <typename _T>
+struct CQuArith<_T, false> {
+	static _T Mod(const _T &a, const _T &b)	{ return (_T)fmod((double)a, (double)b); }
+	static _T And(const _T &a, const _T &b)	{ return (_T)((long long)a & (long long)b); }
+	static _T Or(const _T &a, const _T &b)	{ return (_T)((long long)a | (long long)b); }
+	static _T Xor(const _T &a, const _T &b)	{ return (_T)((long long)a ^ (long long)b); }
+	static _T Not(const _T &a)				{ return (_T)~(long long)a; }
+	static _T Shl(const _T &a, int i)		{ return (_T)((long long)a << i); }
+	static _T Shr(const _T &a, int i)		{ return (_T)((long long)a >> i); }
+};
+
+
+/*
+** Sums, differences and negations of integers wrap around. Signed ones are
+** worked in the unsigned type of the same size, where wrapping is defined,
+** and converted back (modulo 2^N, as g++ and C++20 do), rather than left to
+** overflow, which is undefined. So adding a constant is always one to one.
+*/
+template <typename _T, bool bWrap = is_integral<_T>::value && !is_same<_T, bool>::value>
+struct CQuWrap {
+	static _T Add(const _T &a, const _T &b)	{ return a+b; }
+	static _T Sub(const _T &a, const _T &b)	{ return a-b; }
+	static _T Neg(const _T &a)				{ return -a; }
+	static _T Inc(const _T &a)				{ _T b=a; b++; return b; }
+	static _T Dec(const _T &a)				{ _T b=a; b--; return b; }
+};
+
+template <typename _T>
+struct CQuWrap<_T, true> {
+	typedef typename make_unsigned<_T>::type tU;
+
+	static _T Add(const _T &a, const _T &b)	{ return (_T)(tU)((tU)a + (tU)b); }
+	static _T Sub(const _T &a, const _T &b)	{ return (_T)(tU)((tU)a - (tU)b); }
+	static _T Neg(const _T &a)				{ return (_T)(tU)(0 - (tU)a); }
+	static _T Inc(const _T &a)				{ return (_T)(tU)((tU)a + 1); }
+	static _T Dec(const _T &a)				{ return (_T)(tU)((tU)a - 1); }
+};
+
+
+template <typename _T> class CQuNode;
+template <typename _T> class CQuShard;
+template <typename _T> class CQuAsync;
+template <typename _T> class CQuPacked;
+class CQuRegister;
 
 template <typename _T>
 class CQuBit { 
 
+	friend class CQuNode<_T>;
+	friend class CQuShard<_T>;
+	friend class CQuAsync<_T>;
+	friend class CQuPacked<_T>;
+	friend class CQuRegister;
+
 	private:
 		/*
 		** Operator Callback Prototypes
@@ -37,28 +183,87 @@ class CQuBit {
 		typedef enum { eConj, eDisj, eCollapsedResult, } tQuSuper;
 
 	public:
+		/* States are held with CQuAllocator, which is std::allocator unless QUBIT_STATS is defined */
+		typedef vector<_T, CQuAllocator<_T> >	tQuStates;
 
-		CQuBit<_T>() { m_eType = eConj; m_bResult = false; }
+		CQuBit<_T>() { m_eType = m_eEigenType = eConj; m_bResult = false; m_fTolerance = 0; m_iUlps = 0; }
 		CQuBit<_T>(_T a, _T b, float s=1)		// Construct a range
 				{ 
-				m_eType = eConj; m_bResult = false; 
+				m_eType = m_eEigenType = eConj; m_bResult = false; 
+				m_fTolerance = 0; m_iUlps = 0;
 				AddRange(a,b,s);
 				}
 
 		/*
 		** Quantum States
 		*/
-		void		Clear(void)		{ m_qList.clear(); }
+		void		Clear(void)		{ m_qList.clear(); m_qWeights.clear(); m_Buckets.clear(); touch(); }
 		bool		Add(_T iNewItem)
 					{
-					typename vector<_T>::const_iterator it;
+					typename tQuStates::const_iterator it;
 
 						/* add if unique */
-						for(it=m_qList.begin();it!=m_qList.end();++it)
-							if (*it == iNewItem)
+						if (HasTolerance())
+							{
+							if (find_near(iNewItem) != m_qList.size())
+								{
+								QUBIT_STATS_ADD(0, true);
 								return false;
+								}
+							m_Buckets.insert(make_pair(bucket(iNewItem), m_qList.size()));
+							}
+						else
+							{
+							for(it=m_qList.begin();it!=m_qList.end();++it)
+								if (*it == iNewItem)
+									{
+									QUBIT_STATS_ADD(it-m_qList.begin()+1, true);
+									return false;
+									}
+							}
+						QUBIT_STATS_ADD(HasTolerance() ? 0 : m_qList.size(), false);
 						
 						m_qList.push_back(iNewItem);
+						if (IsWeighted())
+							m_qWeights.push_back(1.0);
+						touch();
+						return true;
+					}
+		/* Unlike Add, adding an existing state again adds to its weight. States
+		   added without a weight have a weight of 1. */
+		bool		AddWeighted(_T iNewItem, double fWeight)
+					{
+					size_t i;
+
+						if (!IsWeighted())
+							m_qWeights.assign(m_qList.size(), 1.0);
+						touch();
+
+						if (HasTolerance())
+							{
+							i = find_near(iNewItem);
+							if (i != m_qList.size())
+								{
+								QUBIT_STATS_ADD(0, true);
+								m_qWeights[i] += fWeight;
+								return false;
+								}
+							m_Buckets.insert(make_pair(bucket(iNewItem), m_qList.size()));
+							}
+						else
+							{
+							for(i=0;i<m_qList.size();i++)
+								if (m_qList[i] == iNewItem)
+									{
+									QUBIT_STATS_ADD(i+1, true);
+									m_qWeights[i] += fWeight;
+									return false;
+									}
+							}
+						QUBIT_STATS_ADD(HasTolerance() ? 0 : m_qList.size(), false);
+
+						m_qList.push_back(iNewItem);
+						m_qWeights.push_back(fWeight);
 						return true;
 					}
 		bool		AddRange(_T iFirst, _T iLast, float iStep=1)
@@ -70,33 +275,94 @@ class CQuBit {
 						if (fPosRes < 0) fPosRes=-fPosRes;
 
 						Reserve((size_t)fPosRes);
+						QuProgressBegin((uint64_t)fPosRes + 1);
 						for(_T i=iFirst;i<=iLast;i+=(_T)iStep)
+							{
 							rt &= Add(i);
+							if (QuProgressStep(1))
+								break;
+							}
 						return rt;
 					}
 		bool		Remove(_T iOldItem)
 					{
-					typename vector<_T>::iterator it;
+					typename tQuStates::iterator it;
 
 						for(it=m_qList.begin();it!=m_qList.end();++it)
-							if (*it == iOldItem)
+							if (HasTolerance() ? is_near(*it, iOldItem) : *it == iOldItem)
 								{
+								if (IsWeighted())
+									m_qWeights.erase(m_qWeights.begin() + (it-m_qList.begin()));
 								m_qList.erase(it);
+								if (HasTolerance())
+									rebuild_buckets();
+								touch();
 								return true;
 								}
 						
 						return false;
 					}
+		/* O(1) when a tolerance is set, otherwise a linear search (skipped if the Bloom filter rules v out) */
+		bool		Contains(const _T &v) const
+					{
+					typename tQuStates::const_iterator it;
+
+						if (HasTolerance())
+							return find_near(v) != m_qList.size();
+						if (!may_contain(v))
+							return false;
+						for(it=m_qList.begin();it!=m_qList.end();++it)
+							if (*it == v)
+								return true;
+						return false;
+					}
+
+		/*
+		** Tolerance
+		** By default states are only duplicates if they compare equal, so float
+		** arithmetic can leave many near-identical states (e.g. AddRange(10, 11, 0.1f)).
+		** With a tolerance, a state within fEpsilon (or within iUlps units in the
+		** last place) of an existing one is not added again; its weight, if any,
+		** goes to the existing state. Near states are found through a hash of
+		** quantized buckets, so Add and Contains take O(1) rather than O(n).
+		** Results of operations take the tolerance of their operands.
+		*/
+		void		SetTolerance(double fEpsilon)
+					{
+					static_assert(is_arithmetic<_T>::value, "a tolerance needs states that are numbers");
+
+						m_fTolerance = fEpsilon > 0 ? fEpsilon : 0; m_iUlps = 0; merge_near();
+					}
+		void		SetToleranceUlps(unsigned iUlps)
+					{
+					static_assert(is_arithmetic<_T>::value, "a tolerance needs states that are numbers");
+
+						m_iUlps = iUlps; m_fTolerance = 0; merge_near();
+					}
+inline	double		GetTolerance(void) const		{ return m_fTolerance; }
+inline	unsigned	GetToleranceUlps(void) const	{ return m_iUlps; }
+inline	bool		HasTolerance(void) const		{ return m_fTolerance > 0 || m_iUlps > 0; }
 
 inline size_t		GetCount(void) const { return m_qList.size(); }
 inline _T			GetItem(size_t idx) const 
 					{ 
-					typename vector<_T>::const_iterator it;
-
-					for(it=m_qList.begin();it!=m_qList.end();++it,idx--)
-						if (idx==0)	return *it;
-					
-					return (_T)0; 
+					return idx < m_qList.size() ? m_qList[idx] : (_T)0; 
+					}
+inline	bool		IsWeighted(void) const { return !m_qWeights.empty(); }
+inline	double		GetWeight(size_t idx) const 
+					{ 
+					return IsWeighted() ? (idx < m_qWeights.size() ? m_qWeights[idx] : 0.0) : 1.0; 
+					}
+		double		GetTotalWeight(void) const
+					{
+					double fTotal = 0;
+					size_t i;
+
+						if (!IsWeighted())
+							return (double)m_qList.size();
+						for(i=0;i<m_qWeights.size();i++)
+							fTotal += m_qWeights[i];
+						return fTotal;
 					}
 
 		/*
@@ -104,11 +370,41 @@ inline _T			GetItem(size_t idx) const
 		*/
 		_T			Any(size_t iUnused)			/* without the 'unused' variable, C++ can not */
 					{							/* resolve this overloaded 'Any' with the next*/
-					if (m_qList.size() == 0) { return (_T)0; }
-					size_t i = (rand()*(m_qList.size()-1))/QUBIT_RAND_MAX;
-					return GetItem(i);
+					return Observe();
 					iUnused=iUnused;
 					}
+		/* Collapses to a single state, drawn with the calling thread's own engine
+		   (see quRandom.hpp), or with any UniformRandomBitGenerator given. Weighted
+		   states are drawn in proportion to their weight. */
+		_T			Observe(void) const		{ return Observe(CQuRandom::Local()); }
+		template <typename _RNG>
+		_T			Observe(_RNG &rng) const
+					{
+						if (m_qList.size() == 0) { return (_T)0; }
+						return m_qList[sample_index(alias(), rng)];
+					}
+		/* Fills pOut with k independent draws, in O(1) per draw once the alias 
+		   table has been built. */
+		size_t		SampleN(size_t k, _T *pOut) const { return SampleN(k, pOut, CQuRandom::Local()); }
+		template <typename _RNG>
+		size_t		SampleN(size_t k, _T *pOut, _RNG &rng) const
+					{
+					shared_ptr<const CQuAlias> pAlias = alias();
+					size_t i;
+
+						if (m_qList.size() == 0)
+							return 0;
+						for(i=0;i<k;i++)
+							pOut[i] = m_qList[sample_index(pAlias, rng)];
+						return k;
+					}
+		size_t		SampleN(size_t k, vector<_T> &out) const { return SampleN(k, out, CQuRandom::Local()); }
+		template <typename _RNG>
+		size_t		SampleN(size_t k, vector<_T> &out, _RNG &rng) const
+					{
+						out.resize(m_qList.size() ? k : 0);
+						return k && m_qList.size() ? SampleN(k, &out[0], rng) : 0;
+					}
 		CQuBit<_T>	Any(void)
 					{
 					CQuBit<_T> any = *this;
@@ -120,24 +416,49 @@ inline _T			GetItem(size_t idx) const
 		CQuBit<_T>	Any(CQuBit<_T> &a, CQuBit<_T> &b)	/*union*/
 					{
 					CQuBit<_T> ans;
-
-						if (a.GetType() != eCollapsedResult)
+					bool bCache = cache_enabled();
+					size_t n = a.GetType() != eCollapsedResult ? a.GetCount() : 0;
+					size_t m = b.GetType() != eCollapsedResult ? b.GetCount() : 0;
+					bool bBounded = false;
+					CQuShape<_T> sa, sb;
+					_T lo = _T(), hi = _T();
+					CQuCacheKey key;
+
+						QUBIT_STATS_SCOPE(eQuKindSetAny, a.GetCount() + b.GetCount());
+						QUBIT_TRACE_RESULT("Any", a.GetCount(), b.GetCount(), &ans);
+						ans.inherit_tolerance(a, b);
+						if (bCache)
 							{
-							typename vector<_T>::iterator it;
-
-							for(it=a.m_qList.begin();it!=a.m_qList.end();++it)
-								ans.Add(*it);
+							key = cache_key(eQuKindSetAny, a.cache_operand(), b.cache_operand(), 0);
+							if (ans.cache_find(key))
+								return ans;
 							}
 
-						if (b.GetType() != eCollapsedResult)
+						/* a bitset spans both operands */
+						if (is_integral<_T>::value && n + m && ans.plan_measure(n + m))
 							{
-							typename vector<_T>::iterator it;
-
-							for(it=b.m_qList.begin();it!=b.m_qList.end();++it)
-								ans.Add(*it);
+							sa.Measure(a.m_qList.data(), n);
+							sb.Measure(b.m_qList.data(), m);
+							lo = !n || (m && sb.m_Min < sa.m_Min) ? sb.m_Min : sa.m_Min;
+							hi = !n || (m && sa.m_Max < sb.m_Max) ? sb.m_Max : sa.m_Max;
+							bBounded = true;
 							}
+						ans.m_Plan = ans.plan_generate(eQuKindSetAny, n, m, (double)(n + m), 
+													   bBounded ? span(lo, hi) : -1, false, false);
+
+						QuProgressBegin(n + m);
+						{
+						CQuAdder add(ans, ans.m_Plan, false, lo, hi, (double)(n + m));
+						size_t i;
+
+							for(i=0;i<n && !QuProgressStep(1);i++)
+								add(a.m_qList[i], 1.0);
+							for(i=0;i<m && !QuProgressStep(1);i++)
+								add(b.m_qList[i], 1.0);
+						}
 
 						ans.SetType(eDisj);
+						if (bCache)	ans.cache_store(key);
 						return ans;
 					}
 		CQuBit<_T>	All(void) 
@@ -151,16 +472,71 @@ inline _T			GetItem(size_t idx) const
 		CQuBit<_T>	All(CQuBit<_T> &a, CQuBit<_T> &b)	/*intersection*/
 					{
 					CQuBit<_T> ans;
+					bool bCache = cache_enabled();
+					CQuShape<_T> sa, sb;
+					CQuCacheKey key;
+
+						QUBIT_STATS_SCOPE(eQuKindSetAll, a.GetCount() * b.GetCount());
+						QUBIT_TRACE_RESULT("All", a.GetCount(), b.GetCount(), &ans);
+						ans.inherit_tolerance(a, b);
+						if (bCache)
+							{
+							key = cache_key(eQuKindSetAll, a.cache_operand(), b.cache_operand(), 0);
+							if (ans.cache_find(key))
+								return ans;
+							}
 
 						if (a.GetType() != eCollapsedResult && 
 							b.GetType() != eCollapsedResult)
 							{
-							typename vector<_T>::iterator ita, itb;
+							typename tQuStates::iterator ita, itb;
+
+							ans.m_Plan = CQuPlanInfo(eQuKindSetAll, a.GetCount(), b.GetCount(), (double)a.GetCount()*b.GetCount());
+							if (ans.plan_measure(ans.m_Plan.m_fCost[eQuPlanNested]))
+								{
+								sa.Measure(a.m_qList.data(), a.GetCount());
+								sb.Measure(b.m_qList.data(), b.GetCount());
+								plan_member(ans.m_Plan, a.GetCount(), sa, sb);
+								}
+							ans.m_Plan.Choose();
+							QuProgressBegin((uint64_t)a.GetCount()*b.GetCount());
 
-							for(ita=a.m_qList.begin();ita!=a.m_qList.end();ita++)
-								for(itb=b.m_qList.begin();itb!=b.m_qList.end();itb++)
-									if (*ita == *itb)
+							if (ans.HasTolerance())
+								{
+								/* near states are matched through whichever side has an index */
+								for(ita=a.m_qList.begin();ita!=a.m_qList.end();ita++)
+									{
+									if (b.HasTolerance() ? b.Contains(*ita) : ans.near_any(*ita, b))
 										ans.Add(*ita);
+									if (QuProgressStep(b.GetCount()))
+										break;
+									}
+								}
+							else if (ans.m_Plan.m_ePlan != eQuPlanNested)
+								{
+								CQuMember member(b, sa, sb, ans.m_Plan.m_ePlan);
+
+								/* a's states are already distinct */
+								for(ita=a.m_qList.begin();ita!=a.m_qList.end();ita++)
+									{
+									if (b.may_contain(*ita) && member(*ita))
+										ans.m_qList.push_back(*ita);
+									if (QuProgressStep(b.GetCount()))
+										break;
+									}
+								}
+							else
+								{
+								for(ita=a.m_qList.begin();ita!=a.m_qList.end();ita++)
+									{
+									if (b.may_contain(*ita))
+										for(itb=b.m_qList.begin();itb!=b.m_qList.end();itb++)
+											if (*ita == *itb)
+												ans.Add(*ita);
+									if (QuProgressStep(b.GetCount()))
+										break;
+									}
+								}
 							}
 						else if (a.GetType() == eCollapsedResult)
 							{
@@ -172,6 +548,7 @@ inline _T			GetItem(size_t idx) const
 							}
 
 						ans.SetType(eConj);
+						if (bCache)	ans.cache_store(key);
 						return ans;
 					}
 
@@ -181,7 +558,7 @@ inline _T			GetItem(size_t idx) const
 
 						if (GetType() == eCollapsedResult)
 							{
-							typename vector<_T>::const_iterator it;
+							typename tQuStates::const_iterator it;
 
 							for(it=m_Eigenstates.begin();it!=m_Eigenstates.end();++it)
 								e.Add(*it);
@@ -193,6 +570,32 @@ inline _T			GetItem(size_t idx) const
 					}
 	inline tQuSuper GetType(void) const			{ return m_eType; }
 	inline	bool	GetBoolResult(void) const	{ return m_bResult; }
+	inline	size_t	GetEigenCount(void) const	{ return m_Eigenstates.size(); }
+
+		/* A hash of the complete contents, for caching (see quCache.hpp) */
+		uint64_t	GetFingerprint(void) const	{ return fingerprint(0); }
+	static	uint64_t GetFingerprint(const _T &v)	{ return QuHashBytes(&v, sizeof(_T), sizeof(_T)); }
+		/* The same contents, bit for bit, as far as GetFingerprint looks (see quIntern.hpp) */
+		bool		IsIdentical(const CQuBit<_T> &q) const
+					{
+						if (m_eType != q.m_eType || m_qList.size() != q.m_qList.size() || m_qWeights.size() != q.m_qWeights.size())
+							return false;
+						if (HasTolerance() != q.HasTolerance() || 
+							(HasTolerance() && (m_fTolerance != q.m_fTolerance || m_iUlps != q.m_iUlps)))
+							return false;
+						if (m_eType == eCollapsedResult && 
+							(m_eEigenType != q.m_eEigenType || m_bResult != q.m_bResult || 
+							 m_Eigenstates.size() != q.m_Eigenstates.size() ||
+							 memcmp(m_Eigenstates.data(), q.m_Eigenstates.data(), m_Eigenstates.size()*sizeof(_T)) != 0))
+							return false;
+						return memcmp(m_qList.data(), q.m_qList.data(), m_qList.size()*sizeof(_T)) == 0 &&
+							   memcmp(m_qWeights.data(), q.m_qWeights.data(), m_qWeights.size()*sizeof(double)) == 0;
+					}
+
+		/* How this superposition was computed, and the estimated cost of each way
+		   it could have been (see quPlan.hpp), e.g. cout << (a * b).Explain(); */
+	inline	const CQuPlanInfo &GetPlan(void) const	{ return m_Plan; }
+		string		Explain(void) const				{ return m_Plan.Explain(); }
 		
 		/*
 		** Overloads
@@ -284,6 +687,8 @@ inline _T			GetItem(size_t idx) const
 			return *this=ans;	}
 		CQuBit<_T> &operator+=(const _T &rhs)
 		{	CQuBit<_T> ans;	
+			if (oper_in_place(&CQuBit<_T>::qop_add, rhs))
+				return *this;
 			ans.do_oper_type(*this, rhs, &CQuBit<_T>::qop_add);	
 			return *this=ans;	}
 
@@ -301,6 +706,8 @@ inline _T			GetItem(size_t idx) const
 			return *this=ans;	}
 		CQuBit<_T> &operator-=(const _T &rhs)
 		{	CQuBit<_T> ans;	
+			if (oper_in_place(&CQuBit<_T>::qop_sub, rhs))
+				return *this;
 			ans.do_oper_type(*this, rhs, &CQuBit<_T>::qop_sub);	
 			return *this=ans;	}
 
@@ -346,15 +753,16 @@ inline _T			GetItem(size_t idx) const
 		{
 			if (this != &q)
 				{
-				typename vector<_T>::const_iterator it;
-
-				m_qList.clear();
-				for(it=q.m_qList.begin();it!=q.m_qList.end();++it)
-					Add(*it);
-
-				m_Eigenstates.clear();
-				for(it=q.m_Eigenstates.begin();it!=q.m_Eigenstates.end();++it)
-					m_Eigenstates.push_back(*it);
+				/* q's states are already unique, so they can be copied wholesale */
+				m_qList = q.m_qList;
+				m_qWeights = q.m_qWeights;
+				m_Eigenstates = q.m_Eigenstates;
+				m_pAlias = atomic_load(&q.m_pAlias);
+				m_pBloom = atomic_load(&q.m_pBloom);
+				m_fTolerance = q.m_fTolerance;
+				m_iUlps = q.m_iUlps;
+				m_Buckets = q.m_Buckets;
+				m_Plan = q.m_Plan;
 			
 				m_bResult = q.m_bResult;
 				m_eType = q.m_eType;
@@ -377,6 +785,8 @@ inline _T			GetItem(size_t idx) const
 			return *this=ans;	}
 		CQuBit<_T> &operator^=(const _T &rhs)
 		{	CQuBit<_T> ans;	
+			if (oper_in_place(&CQuBit<_T>::qop_xor, rhs))
+				return *this;
 			ans.do_oper_type(*this, rhs, &CQuBit<_T>::qop_xor);	
 			return *this=ans;	}
 
@@ -408,9 +818,12 @@ inline _T			GetItem(size_t idx) const
 
 		CQuBit<_T> &operator++(void)			/* prefix */
 		{	
-		CQuBit c=*this;
+		CQuBit c;
 
-			m_qList.clear();
+			if (incdec_in_place(qop_inc))
+				return *this;
+			c = *this;
+			Clear();
 			do_incdec_oper(c, qop_inc);
 			return *this;
 		}
@@ -418,15 +831,20 @@ inline _T			GetItem(size_t idx) const
 		{	
 		CQuBit c=*this;
 
-			m_qList.clear();
+			if (incdec_in_place(qop_inc))
+				return c;
+			Clear();
 			do_incdec_oper(c, qop_inc);
 			return c;
 		}
 		CQuBit<_T> &operator--(void)			/* prefix */
 		{	
-		CQuBit c=*this;
+		CQuBit c;
 
-			m_qList.clear();
+			if (incdec_in_place(qop_dec))
+				return *this;
+			c = *this;
+			Clear();
 			do_incdec_oper(c, qop_dec);
 			return *this;
 		}
@@ -434,7 +852,9 @@ inline _T			GetItem(size_t idx) const
 		{	
 		CQuBit c=*this;
 
-			m_qList.clear();
+			if (incdec_in_place(qop_dec))
+				return c;
+			Clear();
 			do_incdec_oper(c, qop_dec);
 			return c;
 		}
@@ -530,10 +950,12 @@ inline _T			GetItem(size_t idx) const
 		*/
 	friend  ostream &operator<<(ostream &os, const CQuBit<_T> &q)
 				{
-				typename vector<_T>::const_iterator it;
+				typename tQuStates::const_iterator it;
+				QUBIT_TRACE_SCOPE("ostream", q.GetCount(), 0);
 
+					QuProgressBegin(q.GetCount());
 					os << "{ ";
-					for(it=q.m_qList.begin();it!=q.m_qList.end();++it)
+					for(it=q.m_qList.begin();it!=q.m_qList.end() && !QuProgressStep(1);++it)
 						os << *it << " ";
 					os << "}";
 					return os;
@@ -542,6 +964,7 @@ inline _T			GetItem(size_t idx) const
 				{
 				_T	val;
 				char c;
+				QUBIT_TRACE_RESULT("istream", 0, 0, &q);
 
 					do
 						is >> c;
@@ -560,11 +983,195 @@ inline _T			GetItem(size_t idx) const
 							q.Add(val);
 							}					
 						}
-					while(!is.eof() && c!='}');
+					while(!is.eof() && c!='}' && !QuProgressStep(1));
 					
 					return is;
 				}
 
+		/*
+		** Run-time Operators
+		*/
+		static _T	Apply(tQuOper op, const _T &a, const _T &b)
+					{
+						switch(op)
+							{
+							case eQuOpAdd:	return qop_add(a, b);
+							case eQuOpSub:	return qop_sub(a, b);
+							case eQuOpMul:	return qop_mul(a, b);
+							case eQuOpDiv:	return qop_div(a, b);
+							case eQuOpMod:	return qop_mod(a, b);
+							case eQuOpBand:	return qop_band(a, b);
+							case eQuOpBor:	return qop_bor(a, b);
+							case eQuOpXor:	return qop_xor(a, b);
+							case eQuOpLand:	return qop_land(a, b);
+							case eQuOpLor:	return qop_lor(a, b);
+							}
+						return (_T)0;
+					}
+		static bool	Compare(tQuCond co, const _T &a, const _T &b)
+					{
+						switch(co)
+							{
+							case eQuCoLt:	return qco_lt(a, b);
+							case eQuCoLte:	return qco_lte(a, b);
+							case eQuCoGt:	return qco_gt(a, b);
+							case eQuCoGte:	return qco_gte(a, b);
+							case eQuCoEq:	return qco_eq(a, b);
+							case eQuCoNeq:	return qco_neq(a, b);
+							}
+						return false;
+					}
+
+		/*
+		** Reductions
+		** The Get* forms return a scalar ((_T)0 if there are no states, as
+		** GetItem does), the others a single-state superposition (or an empty
+		** one) so the answer can feed further quantum expressions.
+		*/
+		_T			GetMin(void) const		{ return reduce(CQuRedMin(), GetItem(0)); }
+		_T			GetMax(void) const		{ return reduce(CQuRedMax(), GetItem(0)); }
+		_T			GetSum(void) const		{ return reduce(CQuRedSum(), (_T)0); }
+		_T			GetProduct(void) const	{ return reduce(CQuRedProduct(), (_T)1); }
+		size_t		GetCountIf(tQuCond co, const _T &rhs) const
+					{
+					vector<size_t> partial(QuChunkCount(GetCount(), QUBIT_PARALLEL_GRAIN), 0);
+					size_t i, iCount = 0;
+
+						QuParallelFor(GetCount(), QUBIT_PARALLEL_GRAIN,
+							[&](size_t iChunk, size_t iBegin, size_t iEnd)
+							{
+							unsigned char flags[QUBIT_BATCH_TILE];
+							size_t iTile, iSize, j, n = 0;
+
+								for(iTile=iBegin;iTile<iEnd;iTile+=QUBIT_BATCH_TILE)
+									{
+									iSize = iEnd-iTile < QUBIT_BATCH_TILE ? iEnd-iTile : QUBIT_BATCH_TILE;
+									batch_cond(co, &m_qList[iTile], iSize, rhs, flags);
+									for(j=0;j<iSize;j++)
+										n += flags[j];
+									}
+								partial[iChunk] = n;
+							});
+
+						for(i=0;i<partial.size();i++)
+							iCount += partial[i];
+						return iCount;
+					}
+		/* Any associative operator, e.g. q.GetReduce(gcd, 0), applied to the
+		   states in order (it need not be commutative). 'identity' is also the
+		   result for an empty superposition. */
+		template <typename _OP>
+		_T			GetReduce(_OP op, const _T &identity) const	{ return reduce(op, identity); }
+
+		CQuBit<_T>	Min(void) const			{ return singleton(GetMin()); }
+		CQuBit<_T>	Max(void) const			{ return singleton(GetMax()); }
+		CQuBit<_T>	Sum(void) const			{ return singleton(GetSum()); }
+		CQuBit<_T>	Product(void) const		{ return singleton(GetProduct()); }
+		template <typename _OP>
+		CQuBit<_T>	Reduce(_OP op, const _T &identity) const { return singleton(reduce(op, identity)); }
+
+		/*
+		** Order Statistics
+		** Found by selection (introselect), not a full sort. The results are 
+		** superpositions of the same type as this one, in rank order.
+		*/
+		CQuBit<_T>	BottomK(size_t k) const		/* the k smallest, smallest first */
+					{
+					CQuBit<_T> ans;
+
+						select(k, less<_T>(), ans.m_qList);
+						ans.SetType(GetType()==eCollapsedResult ? eConj : GetType());
+						return ans;
+					}
+		CQuBit<_T>	TopK(size_t k) const		/* the k largest, largest first */
+					{
+					CQuBit<_T> ans;
+
+						select(k, greater<_T>(), ans.m_qList);
+						ans.SetType(GetType()==eCollapsedResult ? eConj : GetType());
+						return ans;
+					}
+		CQuBit<_T>	NthElement(size_t n) const	/* the state of rank n (from 0), if there is one */
+					{
+					CQuBit<_T> ans = BottomK(n+1);
+
+						if (ans.GetCount() == n+1)
+							ans.m_qList.erase(ans.m_qList.begin(), ans.m_qList.begin()+n);
+						else
+							ans.Clear();
+						return ans;
+					}
+		CQuBit<_T>	Quantile(double q) const	/* the state of rank round(q*(count-1)), i.e. 0.5 is the median */
+					{
+						if (GetType() == eCollapsedResult || GetCount() == 0)
+							return CQuBit<_T>();
+						if (q < 0)	q = 0;
+						if (q > 1)	q = 1;
+						return NthElement((size_t)floor(q*(GetCount()-1) + 0.5));
+					}
+
+		/*
+		** Filtered Products
+		*/
+		/* ((*this OP b) COND rhs), collapsed just as the longhand expression is, but
+		   each pair is tested as it is made, so only the eigenstates are kept. Where
+		   OP is monotone (+, -, *) and COND an ordering or ==, each state of *this
+		   searches b (in order) for the run of states that can pass, and skips the
+		   rest. e.g. a.Where(eQuOpMul, b, eQuCoLt, limit) for (a * b) < limit */
+		CQuBit<_T>	Where(tQuOper op, const CQuBit<_T> &b, tQuCond co, const _T &rhs) const
+					{
+					CQuBit<_T> ans;
+
+						ans.do_where(*this, op, b, co, rhs);
+						return ans;
+					}
+		/* Estimates what Where would give from iSamples pairs, drawn uniformly (with
+		   replacement) with the calling thread's engine or the one given, and stops
+		   early after fSeconds if that is set. For products too large to wait for,
+		   e.g. a.Estimate(eQuOpMul, b, eQuCoLt, limit, 0, 0.5) for half a second's
+		   worth. Intervals are to the confidence fZ standard deviations give (95% by
+		   default). Collapsed operands are left to Where, and only m_bResult and
+		   the eigenstate counts are filled in. */
+		CQuEstimate<_T> Estimate(tQuOper op, const CQuBit<_T> &b, tQuCond co, const _T &rhs,
+								 size_t iSamples = QUBIT_ESTIMATE_SAMPLES, double fSeconds = 0,
+								 double fZ = QUBIT_ESTIMATE_Z) const
+					{
+						return Estimate(op, b, co, rhs, CQuRandom::Local(), iSamples, fSeconds, fZ);
+					}
+		template <typename _RNG>
+		CQuEstimate<_T> Estimate(tQuOper op, const CQuBit<_T> &b, tQuCond co, const _T &rhs, _RNG &rng,
+								 size_t iSamples = QUBIT_ESTIMATE_SAMPLES, double fSeconds = 0,
+								 double fZ = QUBIT_ESTIMATE_Z) const
+					{
+					CQuEstimate<_T> est;
+
+						do_estimate(est, *this, op, b, co, rhs, rng, iSamples, fSeconds, fZ);
+						return est;
+					}
+
+		/*
+		** Batch Evaluation
+		*/
+		/* Evaluates ((x OP *this) COND rhs) for every x in 'inputs', as QIsPrime's
+		   PERL form does for (i % prime.All()) != 0 (see main.cpp), but shares this superposition across the whole
+		   batch. When pPrefix is given, inputs[i] only sees the first (*pPrefix)[i]
+		   states (or all of them, if there are fewer, or pPrefix stops short of i).
+		   Each result is collapsed exactly as the longhand expression would be,
+		   but only carries its eigenstates if bEigenstates is set. */
+		void		BatchCondition(const vector<_T> &inputs, tQuOper op, tQuCond co, const _T &rhs,
+								vector<CQuBit<_T> > &results, bool bEigenstates=false,
+								const vector<size_t> *pPrefix=NULL) const
+					{
+					size_t iStates = GetType()==eCollapsedResult ? 0 : GetCount();
+					size_t iGrain = QUBIT_PARALLEL_GRAIN / (iStates ? iStates : 1);
+
+						results.clear();
+						results.resize(inputs.size());
+						QuParallelFor(inputs.size(), iGrain ? iGrain : 1, 
+							[&](size_t, size_t iBegin, size_t iEnd)
+							{ do_batch_rows(inputs, iBegin, iEnd, op, co, rhs, results, bEigenstates, pPrefix); });
+					}
+
 	private:
 		/*
 		** Implementation
@@ -572,128 +1179,942 @@ inline _T			GetItem(size_t idx) const
 		bool						m_bResult;		/* from a condition */
 		tQuSuper					m_eType;
 		tQuSuper					m_eEigenType;
-		vector<_T, allocator<_T> >	m_qList;
-		vector<_T, allocator<_T> >	m_Eigenstates;
+		tQuStates					m_qList;
+		tQuStates					m_Eigenstates;
+		vector<double>				m_qWeights;		/* empty, unless states are weighted */
+mutable	shared_ptr<const CQuAlias>	m_pAlias;		/* built on first weighted draw */
+mutable	shared_ptr<const CQuBloom>	m_pBloom;		/* built on first probe, see QuSetBloomMin */
+		double						m_fTolerance;	/* 0, unless states within it are merged */
+		unsigned					m_iUlps;		/* or, the units in the last place */
+		unordered_multimap<int64_t, size_t>	m_Buckets;	/* states by bucket, when there is a tolerance */
+		CQuPlanInfo					m_Plan;			/* of the operation that gave this result */
 
 	inline	void	SetType(tQuSuper t) { m_eType = t; }
 	inline	void	Reserve(size_t i)	{ m_qList.reserve(i); }
-		
+	inline	void	touch(void)
+					{
+						if (m_pAlias) atomic_store(&m_pAlias, shared_ptr<const CQuAlias>());
+						if (m_pBloom) atomic_store(&m_pBloom, shared_ptr<const CQuBloom>());
+					}
+
 		/*
-		** Operator Handling
+		** Tolerance
+		** Buckets are as wide as the tolerance, so a near state is always in
+		** the same bucket as v, or in one of the two either side of it. Only
+		** numbers can have a tolerance (see SetTolerance), so for other types
+		** these are never called, but must still compile.
 		*/
-		bool	do_oper			(const CQuBit<_T> &a, const CQuBit<_T> &b, cbOperation cb)
+		void	inherit_tolerance(const CQuBit<_T> &a, const CQuBit<_T> &b)
 				{
-				typename vector<_T>::iterator ita, itb;
+				const CQuBit<_T> &from = a.HasTolerance() ? a : b;
 
-					if (a.GetType() == eCollapsedResult)	return false;
-					if (b.GetType() == eCollapsedResult)	return false;
-					
-					Reserve(a.GetCount()*b.GetCount());
-					for(ita=a.m_qList.begin();ita!=a.m_qList.end();ita++)
-						for(itb=b.m_qList.begin();itb!=b.m_qList.end();itb++)
-							Add(cb(*ita, *itb));
-					
-					SetType(a.GetType());
-					
-					return true;
+					m_fTolerance = from.m_fTolerance;
+					m_iUlps = from.m_iUlps;
 				}
-
-		bool	do_oper_type	(const CQuBit<_T> &a, const _T &b, cbOperation cb)
+		static int64_t ordered(const _T &v)		/* ordered, as v, by units in the last place */
 				{
-				typename vector<_T>::const_iterator it;
+					if constexpr (is_floating_point<_T>::value && sizeof(_T) == sizeof(int32_t))
+						{
+						int32_t i;
 
-					if (a.GetType() == eCollapsedResult)	return false;
-					
-					Reserve(a.GetCount());
+						memcpy(&i, &v, sizeof(i));
+						return i < 0 ? -(int64_t)(i & 0x7fffffff) : i;
+						}
+					else if constexpr (is_floating_point<_T>::value)
+						{
+						double d = (double)v;
+						int64_t i;
 
-					for(it=a.m_qList.begin();it!=a.m_qList.end();++it)
-						Add(cb(*it, b));
-					
-					SetType(a.GetType());
-					
-					return true;
+						memcpy(&i, &d, sizeof(i));
+						return i < 0 ? -(i & 0x7fffffffffffffffLL) : i;
+						}
+					else if constexpr (is_arithmetic<_T>::value)
+						return (int64_t)v;
+					else
+						return 0;
 				}
-		bool	do_oper_type	(const _T &a, const CQuBit<_T> &b, cbOperation cb)
+		int64_t	bucket			(const _T &v) const
 				{
-				typename vector<_T>::const_iterator it;
-					if (b.GetType() == eCollapsedResult)	return false;
-					
-					Reserve(b.GetCount());
+				double x = 0;
+				int64_t i;
 
-					for(it=b.m_qList.begin();it!=b.m_qList.end();++it)
-						Add(cb(a, *it));
-					
-					SetType(b.GetType());
-					
-					return true;
+					if (m_iUlps)
+						{
+						i = ordered(v);
+						return i >= 0 ? i / m_iUlps : -((-i + m_iUlps - 1) / m_iUlps);
+						}
+					if constexpr (is_arithmetic<_T>::value)
+						x = floor((double)v / m_fTolerance);
+					if (x != x)	return INT64_MIN;			/* NaN, which is never near */
+					if (x < -4e18)	return -(int64_t)4e18;
+					if (x > 4e18)	return (int64_t)4e18;
+					return (int64_t)x;
 				}
-		bool	do_unary_oper	(const CQuBit<_T> &a, cbUnaryOperation cb)
+		bool	is_near			(const _T &a, const _T &b) const
 				{
-				typename vector<_T>::const_iterator it;
-
-					if (a.GetType() == eCollapsedResult)	return false;
-					
-					Reserve(a.GetCount());
+				int64_t i;
 
-					for(it=a.m_qList.begin();it!=a.m_qList.end();++it)
-						Add(cb(*it));
-					
-					SetType(a.GetType());
-					
-					return true;
+					if (a == b)
+						return true;
+					if (m_iUlps)
+						{
+						i = ordered(a) - ordered(b);
+						return (i < 0 ? -i : i) <= (int64_t)m_iUlps;
+						}
+					if constexpr (is_arithmetic<_T>::value)
+						return fabs((double)a - (double)b) <= m_fTolerance;
+					else
+						return false;
 				}
-
-		bool	do_incdec_oper	(const CQuBit<_T> &a, cbIncDecOperation cb)
+		/* the index of a state near v, or GetCount() if there is none */
+		size_t	find_near		(const _T &v) const
 				{
-				typename vector<_T>::const_iterator it;
+				typedef unordered_multimap<int64_t, size_t>::const_iterator tIt;
+				pair<tIt, tIt> range;
+				int64_t iBucket = bucket(v), i;
+				tIt it;
+
+					if (iBucket == INT64_MIN)
+						return m_qList.size();
+					for(i=iBucket-1;i<=iBucket+1;i++)
+						{
+						range = m_Buckets.equal_range(i);
+						for(it=range.first;it!=range.second;++it)
+							if (is_near(m_qList[it->second], v))
+								return it->second;
+						}
+					return m_qList.size();
+				}
+		bool	near_any		(const _T &v, const CQuBit<_T> &q) const
+				{
+				typename tQuStates::const_iterator it;
 
-					if (a.GetType() == eCollapsedResult)	return false;
-					
-					Reserve(a.GetCount());
+					for(it=q.m_qList.begin();it!=q.m_qList.end();++it)
+						if (is_near(*it, v))
+							return true;
+					return false;
+				}
+		void	rebuild_buckets	(void)
+				{
+				size_t i;
 
-					for(it=a.m_qList.begin();it!=a.m_qList.end();++it)
-						Add(cb(*it));
-					
-					SetType(a.GetType());
-					
-					return true;
+					m_Buckets.clear();
+					if (HasTolerance())
+						for(i=0;i<m_qList.size();i++)
+							m_Buckets.insert(make_pair(bucket(m_qList[i]), i));
+				}
+		/* Re-adds the states under a new tolerance, so near states merge */
+		void	merge_near		(void)
+				{
+				tQuStates states;
+				vector<double> weights;
+				size_t i;
+
+					states.swap(m_qList);
+					weights.swap(m_qWeights);
+					m_Buckets.clear();
+					touch();
+					for(i=0;i<states.size();i++)
+						add_from(states[i], weights.empty() ? 1.0 : weights[i], !weights.empty());
 				}
 
-		bool	do_condition	(const CQuBit<_T> &a, const CQuBit<_T> &b, cbCondOperation cb)
+		/*
+		** Weights and Sampling
+		*/
+		/* Results of an operation are weighted if either operand was */
+		void	add_from		(const _T &v, double fWeight, bool bWeighted)
 				{
-				typename vector<_T>::const_iterator ita, itb;
-				bool rt, conj, disj;
+					if (bWeighted)	AddWeighted(v, fWeight);
+					else			Add(v);
+				}
+		shared_ptr<const CQuAlias> alias(void) const
+				{
+				shared_ptr<const CQuAlias> pAlias = atomic_load(&m_pAlias);
 
-					/* If both have collapsed, compare as if they were booleans, otherwise*/
-					if (a.GetType() == eCollapsedResult && b.GetType() == eCollapsedResult)
-						return cb(a.GetBoolResult(), b.GetBoolResult());
-					if (a.GetType() == eCollapsedResult || b.GetType() == eCollapsedResult)
-						return false;
-					
-					Reserve(a.GetCount());
+					if (!pAlias && IsWeighted())
+						{
+						shared_ptr<CQuAlias> pNew(new CQuAlias);
 
-					/* Note: Not optimal (since we could early out upon failure), but
-					   I feel it demonstrates the workings better.*/
+						QuBuildAlias(m_qWeights, *pNew);
+						pAlias = pNew;
+						atomic_store(&m_pAlias, pAlias);
+						}
+					return pAlias;
+				}
 
-					m_Eigenstates.clear();
+		/*
+		** Bloom filter
+		** Only for exact states that hash as their value: two states that
+		** compare equal must have the same bytes, so -0.0 is hashed as 0.0
+		** (NaN equals nothing, so needs no care).
+		*/
+	static	constexpr bool bloom_type(void)	{ return is_arithmetic<_T>::value && sizeof(_T) <= 8; }
+	static	uint64_t bloom_hash(const _T &v)
+				{
+					if constexpr (is_floating_point<_T>::value)
+						if (v == 0)
+							return GetFingerprint(_T(0));
+					return GetFingerprint(v);
+				}
+		/* Other types never have a filter, and these compile to nothing for them */
+		shared_ptr<const CQuBloom> bloom(void) const
+				{
+				shared_ptr<const CQuBloom> pBloom = atomic_load(&m_pBloom);
+				size_t iMin = QuGetBloomMin();
+				typename tQuStates::const_iterator it;
 
-					for(ita=a.m_qList.begin();ita!=a.m_qList.end();ita++)
+					if constexpr (!bloom_type())
+						return pBloom;
+					else if (!pBloom && iMin && m_qList.size() >= iMin && !HasTolerance())
 						{
-						conj = true;
-						disj = false;
-						
-						for(itb=b.m_qList.begin();itb!=b.m_qList.end();itb++)
+						shared_ptr<CQuBloom> pNew(new CQuBloom(m_qList.size()));
+
+						for(it=m_qList.begin();it!=m_qList.end();++it)
+							pNew->Insert(bloom_hash(*it));
+						pBloom = pNew;
+						atomic_store(&m_pBloom, pBloom);
+						}
+					return pBloom;
+				}
+		/* False only if v is certainly none of the states */
+		bool	may_contain		(const _T &v) const
+				{
+				shared_ptr<const CQuBloom> pBloom;
+
+					if constexpr (bloom_type())
+						{
+						if (!QuGetBloomMin())
+							return true;
+						pBloom = bloom();
+						return !pBloom || pBloom->MayContain(bloom_hash(v));
+						}
+					else
+						return true;
+				}
+
+		template <typename _RNG>
+		size_t	sample_index	(const shared_ptr<const CQuAlias> &pAlias, _RNG &rng) const
+				{
+				size_t i = QuRandomIndex(rng, m_qList.size());
+
+					if (pAlias && QuRandomUnit(rng) >= pAlias->m_Prob[i])
+						i = pAlias->m_Alias[i];
+					return i;
+				}
+		
+		/*
+		** Planning (see quPlan.hpp)
+		** Operands are only measured once an operation is big enough for the
+		** choice to matter. With a tolerance, Add already finds near states
+		** through its buckets, so the nested loop is kept. States that are not
+		** numbers can not be measured, and always take the nested loop.
+		*/
+		bool	plan_measure	(double fWork) const
+				{
+					if constexpr (!is_arithmetic<_T>::value)
+						return false;
+					return fWork >= QUBIT_PLAN_MIN_WORK && QuGetPlan() != eQuPlanNested && !HasTolerance();
+				}
+		/* The number of values from lo to hi, less one */
+		static double span		(const _T &lo, const _T &hi)
+				{
+					if constexpr (is_arithmetic<_T>::value)
+						return (double)hi - (double)lo;
+					else
+						return 0;
+				}
+		/* Bounds on cb(x, y), for x in aLo..aHi and y in bLo..bHi, where they are
+		   known and nothing can overflow. Integers only. */
+		static bool oper_bounds	(cbOperation cb, const _T &aLo, const _T &aHi, const _T &bLo, const _T &bHi, _T &lo, _T &hi)
+				{
+					if constexpr (is_integral<_T>::value)
+						return integer_bounds(cb, (double)aLo, (double)aHi, (double)bLo, (double)bHi, lo, hi);
+					else
+						return false;
+				}
+		static bool integer_bounds(cbOperation cb, double aLo, double aHi, double bLo, double bHi, _T &lo, _T &hi)
+				{
+				double l, h, c[4];
+
+					if (cb == &CQuBit<_T>::qop_add)			{ l = aLo+bLo; h = aHi+bHi; }
+					else if (cb == &CQuBit<_T>::qop_sub)	{ l = aLo-bHi; h = aHi-bLo; }
+					else if (cb == &CQuBit<_T>::qop_mul)
+						{
+						c[0] = aLo*bLo;	c[1] = aLo*bHi;
+						c[2] = aHi*bLo;	c[3] = aHi*bHi;
+						l = *min_element(c, c+4);
+						h = *max_element(c, c+4);
+						}
+					else if (cb == &CQuBit<_T>::qop_mod && aLo >= 0 && bLo > 0)		{ l = 0; h = bHi-1; }
+					else if (cb == &CQuBit<_T>::qop_band && aLo >= 0 && bLo >= 0)	{ l = 0; h = aHi < bHi ? aHi : bHi; }
+					else
+						return false;
+
+					if (l < (double)numeric_limits<_T>::lowest() || h > (double)numeric_limits<_T>::max())
+						return false;
+					if (l < -4e15 || h > 4e15)
+						return false;
+					lo = (_T)l;
+					hi = (_T)h;
+					return true;
+				}
+		/* For fStates states generated from operands of iLhs and iRhs states, of
+		   which at most fSpan+1 can differ (fSpan < 0, if that is not known).
+		   fConvolve is the length of the convolution that would find them, if
+		   one can. */
+		CQuPlanInfo plan_generate(tQuKind eKind, size_t iLhs, size_t iRhs, double fStates, double fSpan,
+								 bool bWeighted, bool bRange, double fConvolve = 0) const
+				{
+				CQuPlanInfo plan(eKind, iLhs, iRhs, 0);
+				double fResults = fSpan >= 0 && fSpan+1 < fStates ? fSpan+1 : fStates;
+
+					plan.m_fCost[eQuPlanNested] = HasTolerance() ? fStates*QUBIT_PLAN_COST_HASH : fStates + fStates*fResults/2;
+					if (plan_measure(fStates))
+						{
+						plan.m_fCost[eQuPlanHash] = fStates*QUBIT_PLAN_COST_HASH + fResults;
+						if (fSpan >= 0 && fSpan < QUBIT_PLAN_BITSET_MAX && !bWeighted)
+							plan.m_fCost[eQuPlanBitset] = fStates*QUBIT_PLAN_COST_BIT + fSpan/64;
+						if (bRange)
+							plan.m_fCost[eQuPlanRange] = (double)iLhs + iRhs;
+						if (fConvolve > 0)
+							plan.m_fCost[eQuPlanConvolve] = 2*fConvolve*log2(fConvolve)*QUBIT_PLAN_COST_FFT +
+															fConvolve + fResults*QUBIT_PLAN_COST_HASH;
+						}
+					plan.Choose();
+					return plan;
+				}
+		/* For testing n states (measured as sa) for membership of b (measured as sb) */
+		static void plan_member	(CQuPlanInfo &plan, double n, const CQuShape<_T> &sa, const CQuShape<_T> &sb)
+				{
+				double m = (double)sb.m_iCount, fLog = m > 2 ? log2(m) : 1;
+
+					plan.m_fCost[eQuPlanHash] = (n + m)*QUBIT_PLAN_COST_HASH;
+					if (!sb.m_bNaN)
+						plan.m_fCost[eQuPlanSortMerge] = (sb.m_bAscending ? 0 : m*fLog*QUBIT_PLAN_COST_SORT) +
+														 (sa.m_bAscending ? n + m : n*fLog);
+					if (is_integral<_T>::value && sb.m_iCount && sb.GetSpan() < QUBIT_PLAN_BITSET_MAX)
+						plan.m_fCost[eQuPlanBitset] = (n + m)*QUBIT_PLAN_COST_BIT + sb.GetSpan()/64;
+				}
+
+		/* Evenly spaced integers a and b, with the same step. Their distinct sums
+		   first appear along the first row of pairs, then down the last column
+		   (differences, down the first column), so only those are visited. */
+		static bool range_applies(cbOperation cb, const CQuShape<_T> &sa, const CQuShape<_T> &sb)
+				{
+					return (cb == &CQuBit<_T>::qop_add || cb == &CQuBit<_T>::qop_sub) &&
+						   sa.m_bProgression && sb.m_bProgression && sa.m_iStep == sb.m_iStep;
+				}
+		/* The length of the convolution for integer sums or differences, or 0 if too long */
+		static double convolve_length(cbOperation cb, const CQuShape<_T> &sa, const CQuShape<_T> &sb)
+				{
+				double fLength = sa.GetSpan() + sb.GetSpan() + 1, n = 1;
+
+					if (cb != &CQuBit<_T>::qop_add && cb != &CQuBit<_T>::qop_sub)
+						return 0;
+					while(n < fLength)
+						n *= 2;
+					return n <= QUBIT_PLAN_FFT_MAX ? n : 0;
+				}
+		void	oper_range		(const CQuBit<_T> &a, const CQuBit<_T> &b, cbOperation cb)
+				{
+				size_t i, j = cb == &CQuBit<_T>::qop_add ? b.GetCount()-1 : 0;
+
+					for(i=0;i<b.GetCount();i++)
+						m_qList.push_back(cb(a.m_qList[0], b.m_qList[i]));
+					for(i=1;i<a.GetCount();i++)
+						m_qList.push_back(cb(a.m_qList[i], b.m_qList[j]));
+				}
+
+		/* Sums (or differences) of integers, from a convolution of the operands
+		   over their spans. That gives the states but not the order they first
+		   appear in, so the rows of pairs are then visited in order only until
+		   every state has been seen; each row looks at whichever is fewer, b's
+		   states or the states still to be seen. */
+		void	oper_convolve	(const CQuBit<_T> &a, const CQuBit<_T> &b, cbOperation cb,
+								 const CQuShape<_T> &sa, const CQuShape<_T> &sb)
+				{
+				bool bAdd = cb == &CQuBit<_T>::qop_add;
+				size_t n = a.GetCount(), m = b.GetCount(), i, j, k, iOffset;
+				size_t iSpanB = (size_t)sb.GetSpan() + 1, iRemaining = 0;
+				vector<unsigned char> ia((size_t)sa.GetSpan() + 1, 0), ib(iSpanB, 0), present;
+				vector<size_t> jOf(iSpanB, 0);		/* b's index+1, by offset */
+				vector<size_t> pending, row;
+				bool bStale = true;
+
+					/* offsets are chosen so a's and b's add up to the state's */
+					for(i=0;i<n;i++)
+						ia[offset_a(a.m_qList[i], sa)] = 1;
+					for(j=0;j<m;j++)
+						{
+						k = offset_b(b.m_qList[j], sb, bAdd);
+						ib[k] = 1;
+						jOf[k] = j+1;
+						}
+					QuSumset(ia, ib, present);
+
+					for(k=0;k<present.size();k++)
+						iRemaining += present[k];
+					Reserve(iRemaining);
+
+					for(i=0;i<n && iRemaining;i++)
+						{
+						iOffset = offset_a(a.m_qList[i], sa);
+						if (m <= iRemaining)
 							{
-							rt = cb(*ita, *itb);
-							conj &= rt;
-							disj |= rt;
+							for(j=0;j<m;j++)
+								{
+								k = iOffset + offset_b(b.m_qList[j], sb, bAdd);
+								if (present[k])
+									{
+									present[k] = 0;
+									iRemaining--;
+									m_qList.push_back(cb(a.m_qList[i], b.m_qList[j]));
+									}
+								}
+							bStale = true;
+							continue;
+							}
+
+						if (bStale)
+							{
+							pending.clear();
+							for(k=0;k<present.size();k++)
+								if (present[k])
+									pending.push_back(k);
+							bStale = false;
+							}
+						row.clear();
+						for(k=0;k<pending.size();k++)
+							if (pending[k] >= iOffset && pending[k] - iOffset < iSpanB && jOf[pending[k] - iOffset])
+								row.push_back(jOf[pending[k] - iOffset] - 1);
+						sort(row.begin(), row.end());
+						for(j=0;j<row.size();j++)
+							{
+							present[iOffset + offset_b(b.m_qList[row[j]], sb, bAdd)] = 0;
+							m_qList.push_back(cb(a.m_qList[i], b.m_qList[row[j]]));
 							}
+						iRemaining -= row.size();
+						if (row.size())
+							pending.erase(remove_if(pending.begin(), pending.end(), 
+										  [&](size_t x) { return !present[x]; }), pending.end());
+						}
+				}
+		static size_t offset_a	(const _T &v, const CQuShape<_T> &sa)
+				{
+					return (size_t)(CQuShape<_T>::bits(v) - CQuShape<_T>::bits(sa.m_Min));
+				}
+		/* for a difference, b's offsets run down from its maximum */
+		static size_t offset_b	(const _T &v, const CQuShape<_T> &sb, bool bAdd)
+				{
+					return bAdd ? (size_t)(CQuShape<_T>::bits(v) - CQuShape<_T>::bits(sb.m_Min)) :
+								  (size_t)(CQuShape<_T>::bits(sb.m_Max) - CQuShape<_T>::bits(v));
+				}
+
+		/*
+		** One to one operations. Integers wrap (signed ones in their unsigned
+		** type, see CQuWrap), so adding or subtracting a constant, xor with one,
+		** negation, complement, increment and decrement never send two states
+		** to the same result. Of the floating point operations only negation
+		** is one to one, as sums may round together.
+		**
+		** One to one is not the same as order preserving. The direct plan keeps
+		** each result where its state was, so the results come out in the
+		** order of the states, not sorted: negation and complement reverse an
+		** ascending list, xor scrambles it, and adding a constant to integers
+		** stays ascending only until a sum wraps. Nothing relies on the order;
+		** CQuShape measures it afresh whenever a plan asks.
+		*/
+		static bool injective	(cbOperation cb)
+				{
+					if constexpr (is_integral<_T>::value && !is_same<_T, bool>::value)
+						return cb == &CQuBit<_T>::qop_add || cb == &CQuBit<_T>::qop_sub || cb == &CQuBit<_T>::qop_xor;
+					else
+						return false;
+				}
+		static bool injective	(cbUnaryOperation cb)
+				{
+					if constexpr (is_integral<_T>::value && !is_same<_T, bool>::value)
+						return cb == &CQuBit<_T>::qop_neg || cb == &CQuBit<_T>::qop_one ||
+							   cb == &CQuBit<_T>::qop_inc || cb == &CQuBit<_T>::qop_dec;
+					else if constexpr (is_floating_point<_T>::value)
+						return cb == &CQuBit<_T>::qop_neg;
+					else
+						return false;
+				}
+		/* Offers the direct plan, which needs the results to stay as they are made */
+		void	plan_direct		(CQuPlanInfo &plan, bool bInjective) const
+				{
+					if (!bInjective || HasTolerance())
+						return;
+					plan.m_fCost[eQuPlanDirect] = (double)plan.m_iLhs * (plan.m_iRhs ? plan.m_iRhs : 1);
+					plan.Choose();
+				}
+		/* A one to one operation, applied to the states where they are (if the direct plan is chosen) */
+		template <typename _F>
+		bool	apply_in_place	(tQuKind eKind, uint64_t iRhs, bool bInjective, _F fn)
+				{
+				CQuPlanInfo plan;
+				size_t i;
+
+					if (GetType() == eCollapsedResult)
+						return false;
+					plan = plan_generate(eKind, GetCount(), iRhs, GetCount(), -1, IsWeighted(), false);
+					plan_direct(plan, bInjective);
+					if (plan.m_ePlan != eQuPlanDirect)
+						return false;
+
+					{
+					QUBIT_STATS_SCOPE(eKind, GetCount());
+					QUBIT_TRACE_RESULT("apply_in_place", GetCount(), iRhs, this);
+
+						for(i=0;i<m_qList.size();i++)
+							m_qList[i] = fn(m_qList[i]);
+					}
+					m_Plan = plan;
+					touch();
+					return true;
+				}
+		/* q OP= k, as q = q OP k would leave it */
+		bool	oper_in_place	(cbOperation cb, const _T &k)
+				{
+					if (!apply_in_place(eQuKindOperType, 1, injective(cb), [&](const _T &v) { return cb(v, k); }))
+						return false;
+					m_Eigenstates.clear();
+					m_bResult = false;
+					m_eEigenType = eConj;
+					return true;
+				}
+		bool	incdec_in_place	(cbIncDecOperation cb)
+				{
+					return apply_in_place(eQuKindIncDec, 0, injective(cb), cb);
+				}
+
+		/* Keeps new states as Add and AddWeighted do, through an index if the plan has one */
+		class CQuAdder {
+
+			public:
+				CQuAdder(CQuBit<_T> &q, const CQuPlanInfo &plan, bool bWeighted, const _T &lo, const _T &hi, double fExpected)
+						: m_q(q), m_bWeighted(bWeighted), m_bDirect(plan.m_ePlan == eQuPlanDirect)
+						{
+							if (plan.m_ePlan == eQuPlanHash)
+								m_pIndex.reset(new CQuDedup<_T>((size_t)fExpected));
+							else if (plan.m_ePlan == eQuPlanBitset)
+								m_pIndex.reset(new CQuDedup<_T>(lo, hi));
+						}
+
+				void	operator()(const _T &v, double fWeight)
+						{
+						size_t i = 0;
+
+							if (m_bDirect || (m_pIndex && m_pIndex->Insert(m_q.m_qList, v, &i)))
+								{
+								m_q.m_qList.push_back(v);
+								if (m_bWeighted)
+									m_q.m_qWeights.push_back(fWeight);
+								}
+							else if (!m_pIndex)
+								m_q.add_from(v, fWeight, m_bWeighted);
+							else if (m_bWeighted)
+								m_q.m_qWeights[i] += fWeight;
+						}
+
+			private:
+				CQuBit<_T> &				m_q;
+				bool						m_bWeighted;
+				bool						m_bDirect;	/* the states are known to be distinct */
+				unique_ptr<CQuDedup<_T> >	m_pIndex;
+		};
+
+		/* Whether a state is one of b's, by the hash, sort-merge or bitset plan */
+		class CQuMember {
+
+			public:
+				CQuMember(const CQuBit<_T> &b, const CQuShape<_T> &sa, const CQuShape<_T> &sb, tQuPlan ePlan)
+						: m_b(b.m_qList), m_ePlan(ePlan), m_bMerge(sa.m_bAscending), m_iNext(0)
+						{
+							if (ePlan == eQuPlanSortMerge)
+								{
+								m_Sorted.assign(m_b.begin(), m_b.end());
+								if (!sb.m_bAscending)
+									sort(m_Sorted.begin(), m_Sorted.end());
+								}
+							else
+								{
+								if (ePlan == eQuPlanBitset)
+									m_pIndex.reset(new CQuDedup<_T>(sb.m_Min, sb.m_Max));
+								else
+									m_pIndex.reset(new CQuDedup<_T>(m_b.size()));
+								m_pIndex->Index(m_b);
+								}
+						}
+
+				/* When the states asked about are in ascending order, sorted states are merged */
+				bool	operator()(const _T &v)
+						{
+						typename vector<_T>::const_iterator it;
+
+							if (m_pIndex)
+								return m_pIndex->Contains(m_b, v);
+							if (m_bMerge)
+								{
+								while(m_iNext < m_Sorted.size() && m_Sorted[m_iNext] < v)
+									m_iNext++;
+								return m_iNext < m_Sorted.size() && m_Sorted[m_iNext] == v;
+								}
+							it = lower_bound(m_Sorted.begin(), m_Sorted.end(), v);
+							return it != m_Sorted.end() && *it == v;
+						}
+
+			private:
+				const tQuStates &			m_b;
+				tQuPlan						m_ePlan;
+				bool						m_bMerge;
+				size_t						m_iNext;
+				vector<_T>					m_Sorted;
+				unique_ptr<CQuDedup<_T> >	m_pIndex;
+		};
+
+		/* do_condition, by any plan but the nested loop */
+		void	condition_planned(const CQuBit<_T> &a, const CQuBit<_T> &b, cbCondOperation cb,
+								  const CQuShape<_T> &sa, const CQuShape<_T> &sb)
+				{
+				bool bConj = b.GetType() == eConj;
+				bool bEq = cb == &CQuBit<_T>::qco_eq, bNeq = cb == &CQuBit<_T>::qco_neq;
+				size_t i, m = b.GetCount();
+				unique_ptr<CQuMember> pMember;
+				_T pivot = _T();
+				bool bKeep;
+
+					/* an ordering holds against all of b (or any of b) if it holds against
+					   one extreme. b's states are distinct, so a state can only equal all
+					   of them if there is one, and differ from any of them if there are two. */
+					if (m_Plan.m_ePlan != eQuPlanRange)
+						pMember.reset(new CQuMember(b, sa, sb, m_Plan.m_ePlan));
+					else if (cb == &CQuBit<_T>::qco_lt || cb == &CQuBit<_T>::qco_lte)
+						pivot = bConj ? sb.m_Min : sb.m_Max;
+					else if (cb == &CQuBit<_T>::qco_gt || cb == &CQuBit<_T>::qco_gte)
+						pivot = bConj ? sb.m_Max : sb.m_Min;
+					else if (m)
+						pivot = b.m_qList[0];
+
+					for(i=0;i<a.GetCount();i++)
+						{
+						if (pMember)
+							bKeep = (*pMember)(a.m_qList[i]) == bEq;
+						else if (m == 0)
+							bKeep = bConj;
+						else if ((!bEq && !bNeq) || m == 1)
+							bKeep = cb(a.m_qList[i], pivot);
+						else
+							bKeep = !bConj;
+
+						if (bKeep)
+							m_Eigenstates.push_back(a.m_qList[i]);
+						}
+				}
+
+		/*
+		** Operator Handling
+		*/
+		bool	do_oper			(const CQuBit<_T> &a, const CQuBit<_T> &b, cbOperation cb)
+				{
+				typename tQuStates::const_iterator ita, itb;
+				bool bCache = cache_enabled();
+				bool bWeighted = a.IsWeighted() || b.IsWeighted();
+				bool bBounded = false;
+				double fPairs = (double)a.GetCount()*b.GetCount();
+				CQuShape<_T> sa, sb;
+				_T lo = _T(), hi = _T();
+				CQuCacheKey key;
+
+					QUBIT_STATS_SCOPE(eQuKindOper, a.GetCount()*b.GetCount());
+					QUBIT_TRACE_RESULT("do_oper", a.GetCount(), b.GetCount(), this);
+					inherit_tolerance(a, b);
+					if (a.GetType() == eCollapsedResult)	return false;
+					if (b.GetType() == eCollapsedResult)	return false;
+
+					if (bCache)
+						{
+						key = cache_key(eQuKindOper, a.cache_operand(), b.cache_operand(), cb);
+						if (cache_find(key))
+							return true;
+						}
+					
+					if (plan_measure(fPairs))
+						{
+						sa.Measure(a.m_qList.data(), a.GetCount());
+						sb.Measure(b.m_qList.data(), b.GetCount());
+						bBounded = a.GetCount() && b.GetCount() && 
+								   oper_bounds(cb, sa.m_Min, sa.m_Max, sb.m_Min, sb.m_Max, lo, hi);
+						}
+					m_Plan = plan_generate(eQuKindOper, a.GetCount(), b.GetCount(), fPairs, 
+										   bBounded ? span(lo, hi) : -1, bWeighted,
+										   bBounded && !bWeighted && range_applies(cb, sa, sb),
+										   bBounded && !bWeighted ? convolve_length(cb, sa, sb) : 0);
+
+					Reserve(bBounded && span(lo, hi) < fPairs ? (size_t)(span(lo, hi) + 1) : (size_t)fPairs);
+					QuProgressBegin((uint64_t)fPairs);
+					if (m_Plan.m_ePlan == eQuPlanRange)
+						oper_range(a, b, cb);
+					else if (m_Plan.m_ePlan == eQuPlanConvolve)
+						oper_convolve(a, b, cb, sa, sb);
+					else
+						{
+						CQuAdder add(*this, m_Plan, bWeighted, lo, hi, fPairs);
+
+						for(ita=a.m_qList.begin();ita!=a.m_qList.end();ita++)
+							{
+							for(itb=b.m_qList.begin();itb!=b.m_qList.end();itb++)
+								add(cb(*ita, *itb), 
+									a.GetWeight(ita-a.m_qList.begin()) * b.GetWeight(itb-b.m_qList.begin()));
+							if (QuProgressStep(b.GetCount()))
+								break;
+							}
+						}
+					if (m_Plan.m_ePlan == eQuPlanRange || m_Plan.m_ePlan == eQuPlanConvolve)
+						QuProgressStep((uint64_t)fPairs);
+					
+					SetType(a.GetType());
+					
+					if (bCache)	cache_store(key);
+					
+					return true;
+				}
+
+		bool	do_oper_type	(const CQuBit<_T> &a, const _T &b, cbOperation cb)
+				{
+				typename tQuStates::const_iterator it;
+				bool bCache = cache_enabled();
+				bool bBounded = false;
+				CQuShape<_T> sa;
+				_T lo = _T(), hi = _T();
+				CQuCacheKey key;
+
+					QUBIT_STATS_SCOPE(eQuKindOperType, a.GetCount());
+					QUBIT_TRACE_RESULT("do_oper_type", a.GetCount(), 1, this);
+					inherit_tolerance(a, a);
+					if (a.GetType() == eCollapsedResult)	return false;
+
+					if (bCache)
+						{
+						key = cache_key(eQuKindOperType, a.cache_operand(), cache_operand(b), cb);
+						if (cache_find(key))
+							return true;
+						}
+					
+					if (plan_measure(a.GetCount()))
+						{
+						sa.Measure(a.m_qList.data(), a.GetCount());
+						bBounded = a.GetCount() && oper_bounds(cb, sa.m_Min, sa.m_Max, b, b, lo, hi);
+						}
+					m_Plan = plan_generate(eQuKindOperType, a.GetCount(), 1, a.GetCount(), 
+										   bBounded ? span(lo, hi) : -1, a.IsWeighted(), false);
+					plan_direct(m_Plan, injective(cb));
+
+					Reserve(a.GetCount());
+					{
+					CQuAdder add(*this, m_Plan, a.IsWeighted(), lo, hi, a.GetCount());
+
+						for(it=a.m_qList.begin();it!=a.m_qList.end();++it)
+							add(cb(*it, b), a.GetWeight(it-a.m_qList.begin()));
+					}
+					
+					SetType(a.GetType());
+					
+					if (bCache)	cache_store(key);
+					
+					return true;
+				}
+		bool	do_oper_type	(const _T &a, const CQuBit<_T> &b, cbOperation cb)
+				{
+				typename tQuStates::const_iterator it;
+				bool bCache = cache_enabled();
+				bool bBounded = false;
+				CQuShape<_T> sb;
+				_T lo = _T(), hi = _T();
+				CQuCacheKey key;
+
+					QUBIT_STATS_SCOPE(eQuKindTypeOper, b.GetCount());
+					QUBIT_TRACE_RESULT("do_oper_type", 1, b.GetCount(), this);
+					inherit_tolerance(b, b);
+					if (b.GetType() == eCollapsedResult)	return false;
+
+					if (bCache)
+						{
+						key = cache_key(eQuKindTypeOper, cache_operand(a), b.cache_operand(), cb);
+						if (cache_find(key))
+							return true;
+						}
+					
+					if (plan_measure(b.GetCount()))
+						{
+						sb.Measure(b.m_qList.data(), b.GetCount());
+						bBounded = b.GetCount() && oper_bounds(cb, a, a, sb.m_Min, sb.m_Max, lo, hi);
+						}
+					m_Plan = plan_generate(eQuKindTypeOper, 1, b.GetCount(), b.GetCount(), 
+										   bBounded ? span(lo, hi) : -1, b.IsWeighted(), false);
+					plan_direct(m_Plan, injective(cb));
+
+					Reserve(b.GetCount());
+					{
+					CQuAdder add(*this, m_Plan, b.IsWeighted(), lo, hi, b.GetCount());
+
+						for(it=b.m_qList.begin();it!=b.m_qList.end();++it)
+							add(cb(a, *it), b.GetWeight(it-b.m_qList.begin()));
+					}
+					
+					SetType(b.GetType());
+					
+					if (bCache)	cache_store(key);
+					
+					return true;
+				}
+		bool	do_unary_oper	(const CQuBit<_T> &a, cbUnaryOperation cb)
+				{
+				typename tQuStates::const_iterator it;
+				bool bCache = cache_enabled();
+				CQuCacheKey key;
+
+					QUBIT_STATS_SCOPE(eQuKindUnary, a.GetCount());
+					QUBIT_TRACE_RESULT("do_unary_oper", a.GetCount(), 0, this);
+					inherit_tolerance(a, a);
+					if (a.GetType() == eCollapsedResult)	return false;
+
+					if (bCache)
+						{
+						key = cache_key(eQuKindUnary, a.cache_operand(), CQuCacheOperand(), cb);
+						if (cache_find(key))
+							return true;
+						}
+					
+					m_Plan = plan_generate(eQuKindUnary, a.GetCount(), 0, a.GetCount(), -1, a.IsWeighted(), false);
+					plan_direct(m_Plan, injective(cb));
+
+					Reserve(a.GetCount());
+					{
+					CQuAdder add(*this, m_Plan, a.IsWeighted(), _T(), _T(), a.GetCount());
+
+						for(it=a.m_qList.begin();it!=a.m_qList.end();++it)
+							add(cb(*it), a.GetWeight(it-a.m_qList.begin()));
+					}
+					
+					SetType(a.GetType());
+					
+					if (bCache)	cache_store(key);
+					
+					return true;
+				}
+
+		bool	do_incdec_oper	(const CQuBit<_T> &a, cbIncDecOperation cb)
+				{
+				typename tQuStates::const_iterator it;
+				bool bCache = cache_enabled();
+				CQuCacheKey key;
+
+					QUBIT_STATS_SCOPE(eQuKindIncDec, a.GetCount());
+					QUBIT_TRACE_RESULT("do_incdec_oper", a.GetCount(), 0, this);
+					inherit_tolerance(a, a);
+					if (a.GetType() == eCollapsedResult)	return false;
+
+					if (bCache)
+						{
+						key = cache_key(eQuKindIncDec, a.cache_operand(), CQuCacheOperand(), cb);
+						if (cache_find(key))
+							return true;
+						}
+					
+					m_Plan = plan_generate(eQuKindIncDec, a.GetCount(), 0, a.GetCount(), -1, a.IsWeighted(), false);
+					plan_direct(m_Plan, injective(cb));
+
+					Reserve(a.GetCount());
+					{
+					CQuAdder add(*this, m_Plan, a.IsWeighted(), _T(), _T(), a.GetCount());
+
+						for(it=a.m_qList.begin();it!=a.m_qList.end();++it)
+							add(cb(*it), a.GetWeight(it-a.m_qList.begin()));
+					}
+					
+					SetType(a.GetType());
+					
+					if (bCache)	cache_store(key);
+					
+					return true;
+				}
+
+		bool	do_condition	(const CQuBit<_T> &a, const CQuBit<_T> &b, cbCondOperation cb)
+				{
+				typename tQuStates::const_iterator ita, itb;
+				bool rt, conj, disj;
+				bool bCache = cache_enabled();
+				bool bOrdering = cb != &CQuBit<_T>::qco_eq && cb != &CQuBit<_T>::qco_neq;
+				bool bTrivial = (cb == &CQuBit<_T>::qco_eq && b.GetType() == eConj) ||
+								(cb == &CQuBit<_T>::qco_neq && b.GetType() == eDisj);
+				CQuShape<_T> sa, sb;
+				CQuCacheKey key;
+
+					QUBIT_STATS_SCOPE(eQuKindCondition, a.GetCount()*b.GetCount());
+					QUBIT_TRACE_RESULT("do_condition", a.GetCount(), b.GetCount(), this);
+					/* If both have collapsed, compare as if they were booleans, otherwise*/
+					if (a.GetType() == eCollapsedResult && b.GetType() == eCollapsedResult)
+						return cb(a.GetBoolResult(), b.GetBoolResult());
+					if (a.GetType() == eCollapsedResult || b.GetType() == eCollapsedResult)
+						return false;
+
+					if (bCache)
+						{
+						key = cache_key(eQuKindCondition, a.cache_operand(), b.cache_operand(), cb);
+						if (cache_find(key))
+							return true;
+						}
+					
+					m_Plan = CQuPlanInfo(eQuKindCondition, a.GetCount(), b.GetCount(), (double)a.GetCount()*b.GetCount());
+					if (plan_measure(m_Plan.m_fCost[eQuPlanNested]))
+						{
+						sa.Measure(a.m_qList.data(), a.GetCount());
+						sb.Measure(b.m_qList.data(), b.GetCount());
+						if ((bOrdering && !sb.m_bNaN) || bTrivial)
+							m_Plan.m_fCost[eQuPlanRange] = (double)a.GetCount() + b.GetCount();
+						else if (!bOrdering)
+							plan_member(m_Plan, a.GetCount(), sa, sb);
+						}
+					m_Plan.Choose();
+
+					Reserve(a.GetCount());
+
+					/* Note: Not optimal (since we could early out upon failure), but
+					   I feel it demonstrates the workings better.*/
+
+					m_Eigenstates.clear();
+					QuProgressBegin((uint64_t)a.GetCount()*b.GetCount());
+
+					if (m_Plan.m_ePlan != eQuPlanNested)
+						{
+						condition_planned(a, b, cb, sa, sb);
+						QuProgressStep((uint64_t)a.GetCount()*b.GetCount());
+						}
+					else
+						{
+						for(ita=a.m_qList.begin();ita!=a.m_qList.end();ita++)
+							{
+							conj = true;
+							disj = false;
 						
-						if (b.GetType() == eConj && conj)
-							m_Eigenstates.push_back(*ita);
+							for(itb=b.m_qList.begin();itb!=b.m_qList.end();itb++)
+								{
+								rt = cb(*ita, *itb);
+								conj &= rt;
+								disj |= rt;
+								}
+						
+							if (b.GetType() == eConj && conj)
+								m_Eigenstates.push_back(*ita);
+
+							if (b.GetType() == eDisj && disj)
+								m_Eigenstates.push_back(*ita);
 
-						if (b.GetType() == eDisj && disj)
-							m_Eigenstates.push_back(*ita);
+							if (QuProgressStep(b.GetCount()))
+								break;
+							}
 						}
 					
 					SetType(eCollapsedResult);
@@ -705,30 +2126,56 @@ inline _T			GetItem(size_t idx) const
 					if (a.GetType() == eDisj && m_Eigenstates.size())
 						m_bResult = true;
 					
+					if (bCache)	cache_store(key);
+					
 					return true;
 				}
 
 		bool	do_condition_type(const CQuBit<_T> &a, const _T &b, cbCondOperation cb)
 				{
-				typename vector<_T>::const_iterator it;
-				bool rt, conj, disj;
+				typename tQuStates::const_iterator it;
+				bool rt, conj, disj, bEq;
+				bool bCache = cache_enabled();
+				CQuCacheKey key;
 
+					QUBIT_STATS_SCOPE(eQuKindConditionType, a.GetCount());
+					QUBIT_TRACE_RESULT("do_condition_type", a.GetCount(), 1, this);
 					if (a.GetType() == eCollapsedResult)
 						return a.GetBoolResult();
+
+					if (bCache)
+						{
+						key = cache_key(eQuKindConditionType, a.cache_operand(), cache_operand(b), cb);
+						if (cache_find(key))
+							return true;
+						}
 					
+					m_Plan = CQuPlanInfo(eQuKindConditionType, a.GetCount(), 1, a.GetCount());
 					Reserve(a.GetCount());
 					m_Eigenstates.clear();
 
 					conj = true;
 					disj = false;
-					for(it=a.m_qList.begin();it!=a.m_qList.end();++it)
+					bEq = cb == &CQuBit<_T>::qco_eq;
+					if ((bEq || cb == &CQuBit<_T>::qco_neq) && !a.may_contain(b))
 						{
-						rt = cb(*it, b);
-						if (rt) {
-							m_Eigenstates.push_back(*it);
+						/* b is none of a's states, so every state fails == and passes != */
+						if (!bEq)
+							m_Eigenstates = a.m_qList;
+						conj = !bEq || a.m_qList.empty();
+						disj = !bEq && !a.m_qList.empty();
 						}
-						conj &= rt;
-						disj |= rt;
+					else
+						{
+						for(it=a.m_qList.begin();it!=a.m_qList.end();++it)
+							{
+							rt = cb(*it, b);
+							if (rt) {
+								m_Eigenstates.push_back(*it);
+							}
+							conj &= rt;
+							disj |= rt;
+							}
 						}
 					
 					SetType(eCollapsedResult);
@@ -741,17 +2188,676 @@ inline _T			GetItem(size_t idx) const
 					if (a.GetType() == eDisj && disj)
 						m_bResult = true;
 					
+					if (bCache)	cache_store(key);
+					
+					return true;
+				}
+
+		/*
+		** Filtered Products
+		** The eigenstates are the distinct passing states, in the order the
+		** product would first have held them. A state is only known to pass
+		** by its pair, so skipped pairs just make the conjunction false.
+		*/
+		bool	do_where		(const CQuBit<_T> &a, tQuOper op, const CQuBit<_T> &b, tQuCond co, const _T &rhs)
+				{
+				cbOperation cb = oper_of(op);
+				cbCondOperation cc = cond_of(co);
+				bool bCache = cache_enabled();
+				size_t n = a.GetCount(), m = b.GetCount(), i, j;
+				double fPairs = (double)n*m, fPass;
+				bool conj = true, disj = false, rt;
+				CQuShape<_T> sa, sb;
+				vector<size_t> order, row;
+				vector<_T> sorted;
+				CQuBit<_T> product;
+				CQuCacheKey key;
+				_T v;
+
+					QUBIT_STATS_SCOPE(eQuKindWhere, n*m);
+					QUBIT_TRACE_RESULT("do_where", n, m, this);
+					/* near states merge in the product before they are tested, so 
+					   tolerances (and collapsed operands) take the long way round */
+					if (a.GetType() == eCollapsedResult || b.GetType() == eCollapsedResult ||
+						a.HasTolerance() || b.HasTolerance())
+						{
+						product.do_oper(a, b, cb);
+						return do_condition_type(product, rhs, cc);
+						}
+
+					if (bCache)
+						{
+						key = cache_key(eQuKindWhere, a.cache_operand(), b.cache_operand().With(cache_operand(rhs)), 
+										(uintptr_t)op * 8 + co);
+						if (cache_find(key))
+							return true;
+						}
+
+					m_Plan = CQuPlanInfo(eQuKindWhere, n, m, fPairs);
+					if (plan_measure(fPairs))
+						{
+						sa.Measure(a.m_qList.data(), n);
+						sb.Measure(b.m_qList.data(), m);
+						fPass = where_pass(op, co, rhs, sa, sb);
+						m_Plan.m_fCost[eQuPlanNested] = fPairs*(1 + fPass*QUBIT_PLAN_COST_HASH);
+						if (fPass >= 0)
+							m_Plan.m_fCost[eQuPlanSortMerge] = (sb.m_bAscending ? m : m*log2(m)*QUBIT_PLAN_COST_SORT) + 
+															   n*2*log2(m) + fPairs*fPass*(2 + QUBIT_PLAN_COST_HASH);
+						}
+					m_Plan.Choose();
+
+					m_Eigenstates.clear();
+					QuProgressBegin((uint64_t)fPairs);
+					{
+					CQuDedup<_T> seen(0);
+
+						if (m_Plan.m_ePlan == eQuPlanSortMerge)
+							{
+							order.resize(m);
+							for(j=0;j<m;j++)
+								order[j] = j;
+							if (!sb.m_bAscending)
+								stable_sort(order.begin(), order.end(),
+									[&](size_t x, size_t y) { return b.m_qList[x] < b.m_qList[y]; });
+							sorted.resize(m);
+							for(j=0;j<m;j++)
+								sorted[j] = b.m_qList[order[j]];
+							}
+
+						for(i=0;i<n;i++)
+							{
+							if (m_Plan.m_ePlan == eQuPlanSortMerge)
+								{
+								where_run(a.m_qList[i], op, co, rhs, sorted, order, row);
+								if (row.size() < m)
+									conj = false;
+								if (!sb.m_bAscending)
+									sort(row.begin(), row.end());
+								}
+							else
+								{
+								row.resize(m);
+								for(j=0;j<m;j++)
+									row[j] = j;
+								}
+
+							for(j=0;j<row.size();j++)
+								{
+								v = cb(a.m_qList[i], b.m_qList[row[j]]);
+								rt = cc(v, rhs);
+								conj &= rt;
+								disj |= rt;
+								if (rt && seen.Insert(m_Eigenstates, v))
+									m_Eigenstates.push_back(v);
+								}
+							if (QuProgressStep(m))
+								break;
+							}
+					}
+
+					SetType(eCollapsedResult);
+					m_eEigenType = a.GetType();
+					m_bResult = a.GetType() == eConj ? conj : disj;
+
+					if (bCache)	cache_store(key);
+
 					return true;
 				}
+
+		/*
+		** Estimates
+		** A budget that covers the whole product visits each pair in turn, so
+		** small products cost no more than Where, and come out exact unless the
+		** time runs out first. Otherwise pairs are drawn at random until the
+		** budget (of pairs, or of time) is spent. A budget of 0 pairs is only
+		** bounded by the time.
+		*/
+		template <typename _RNG>
+		static void do_estimate	(CQuEstimate<_T> &est, const CQuBit<_T> &a, tQuOper op, const CQuBit<_T> &b,
+								 tQuCond co, const _T &rhs, _RNG &rng, size_t iSamples, double fSeconds, double fZ)
+				{
+				cbOperation cb = oper_of(op);
+				cbCondOperation cc = cond_of(co);
+				size_t n = a.GetCount(), m = b.GetCount(), i, j, k, iSeen;
+				size_t iOnce = 0, iTwice = 0;
+				chrono::steady_clock::time_point tEnd;
+				bool bConj = a.GetType() == eConj, bExhaust, rt;
+				vector<size_t> counts;
+				CQuBit<_T> exact;
+				_T v;
+
+					if (a.GetType() == eCollapsedResult || b.GetType() == eCollapsedResult)
+						{
+						exact.do_where(a, op, b, co, rhs);
+						est.m_bExact = est.m_bCertain = true;
+						est.m_bResult = exact.GetBoolResult();
+						est.m_fEigenCount = est.m_fEigenLo = est.m_fEigenHi = (double)exact.GetEigenCount();
+						est.m_Seen.assign(exact.m_Eigenstates.begin(), exact.m_Eigenstates.end());
+						return;
+						}
+
+					if (iSamples == 0 && fSeconds <= 0)
+						iSamples = QUBIT_ESTIMATE_SAMPLES;
+					est.m_fPairs = (double)n*m;
+					bExhaust = est.m_fPairs <= (double)iSamples;
+					if (bExhaust)
+						iSamples = n*m;
+					if (fSeconds > 0)
+						tEnd = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(fSeconds));
+					QuProgressBegin(iSamples);
+					{
+					CQuDedup<_T> seen(0);
+
+						for(k=0;bExhaust ? k < iSamples : (iSamples == 0 || k < iSamples);k++)
+							{
+							if (k && k % QUBIT_ESTIMATE_CLOCK == 0)
+								{
+								if (fSeconds > 0 && chrono::steady_clock::now() >= tEnd)
+									break;
+								if (QuProgressStep(QUBIT_ESTIMATE_CLOCK))
+									break;
+								}
+							if (bExhaust)
+								{
+								i = k / m;
+								j = k % m;
+								}
+							else
+								{
+								i = QuRandomIndex(rng, n);
+								j = QuRandomIndex(rng, m);
+								}
+
+							v = cb(a.m_qList[i], b.m_qList[j]);
+							rt = cc(v, rhs);
+							est.m_iSamples++;
+							if (!rt)
+								continue;
+							est.m_iPassed++;
+							if (seen.Insert(est.m_Seen, v, &iSeen))
+								{
+								est.m_Seen.push_back(v);
+								counts.push_back(1);
+								}
+							else
+								counts[iSeen]++;
+							}
+					}
+					/* a cancelled or timed out pass over every pair has only seen the first of a's states */
+					est.m_bExact = bExhaust && est.m_iSamples == iSamples;
+
+					if (est.m_bExact)
+						{
+						est.m_fFraction = est.m_fFractionLo = est.m_fFractionHi = iSamples ? (double)est.m_iPassed / iSamples : 0;
+						est.m_fEigenCount = est.m_fEigenLo = est.m_fEigenHi = (double)est.m_Seen.size();
+						}
+					else
+						{
+						est.m_fFraction = est.m_iSamples ? (double)est.m_iPassed / est.m_iSamples : 0;
+						if (bExhaust)
+							{
+							/* the pairs not reached could all fail, or all pass */
+							est.m_fFractionLo = (double)est.m_iPassed / iSamples;
+							est.m_fFractionHi = (double)(est.m_iPassed + iSamples - est.m_iSamples) / iSamples;
+							}
+						else
+							QuWilson(est.m_iPassed, est.m_iSamples, fZ, est.m_fFractionLo, est.m_fFractionHi);
+
+						/* Chao1, bias corrected, which holds when nothing was seen twice */
+						for(k=0;k<counts.size();k++)
+							{
+							if (counts[k] == 1)	iOnce++;
+							if (counts[k] == 2)	iTwice++;
+							}
+						est.m_fEigenLo = (double)est.m_Seen.size();
+						est.m_fEigenHi = floor(est.GetPassingHi());
+						if (est.m_fEigenHi < est.m_fEigenLo)
+							est.m_fEigenHi = est.m_fEigenLo;
+						est.m_fEigenCount = est.m_fEigenLo + (double)iOnce*(iOnce ? iOnce-1 : 0) / (2.0*(iTwice+1));
+						if (est.m_fEigenCount > est.m_fEigenHi)
+							est.m_fEigenCount = est.m_fEigenHi;
+						}
+
+					/* one counterexample settles a conjunction, one witness a disjunction */
+					if (bConj)
+						{
+						est.m_bResult = est.m_iPassed == est.m_iSamples;
+						est.m_bCertain = est.m_bExact || !est.m_bResult;
+						}
+					else
+						{
+						est.m_bResult = est.m_iPassed != 0;
+						est.m_bCertain = est.m_bExact || est.m_bResult;
+						}
+				}
+
+		/* The share of pairs expected to pass, as if spread evenly over the
+		   product's bounds, or -1 if b can not be searched */
+		static double where_pass(tQuOper op, tQuCond co, const _T &rhs, const CQuShape<_T> &sa, const CQuShape<_T> &sb)
+				{
+				double lo, hi, c[4], f;
+				_T iLo, iHi;
+
+					if (op != eQuOpAdd && op != eQuOpSub && op != eQuOpMul)
+						return -1;
+					if (co == eQuCoNeq || rhs != rhs || sa.m_bNaN || sb.m_bNaN || !sa.m_iCount || !sb.m_iCount)
+						return -1;
+					/* results must be monotone in b, so integers may not overflow, nor floats meet inf */
+					if (is_integral<_T>::value && !oper_bounds(oper_of(op), sa.m_Min, sa.m_Max, sb.m_Min, sb.m_Max, iLo, iHi))
+						return -1;
+					if (!isfinite((double)sa.m_Min) || !isfinite((double)sa.m_Max) ||
+						!isfinite((double)sb.m_Min) || !isfinite((double)sb.m_Max))
+						return -1;
+
+					c[0] = Apply(op, sa.m_Min, sb.m_Min);	c[1] = Apply(op, sa.m_Min, sb.m_Max);
+					c[2] = Apply(op, sa.m_Max, sb.m_Min);	c[3] = Apply(op, sa.m_Max, sb.m_Max);
+					lo = *min_element(c, c+4);
+					hi = *max_element(c, c+4);
+					if (hi <= lo)
+						return 1;
+					switch(co)
+						{
+						case eQuCoLt: case eQuCoLte:	f = ((double)rhs - lo) / (hi - lo);	break;
+						case eQuCoGt: case eQuCoGte:	f = (hi - (double)rhs) / (hi - lo);	break;
+						default:						f = 1 / (hi - lo + 1);				break;
+						}
+					return f < 0 ? 0 : f > 1 ? 1 : f;
+				}
+		/* The (original) indices of b's states for which (x OP b) COND rhs can hold.
+		   x OP b is monotone over b's states in order, so they are a single run. */
+		static void where_run	(const _T &x, tQuOper op, tQuCond co, const _T &rhs,
+								 const vector<_T> &sorted, const vector<size_t> &order, vector<size_t> &row)
+				{
+				bool bRising = !(op == eQuOpSub || (op == eQuOpMul && x < 0));
+				size_t m = sorted.size(), iBelow, iAtMost, iFirst = 0, iEnd = m;
+
+					/* the runs of states below rhs, and not above it */
+					if (bRising)
+						{
+						iBelow = first_failing(m, [&](size_t k) { return Apply(op, x, sorted[k]) < rhs; });
+						iAtMost = first_failing(m, [&](size_t k) { return Apply(op, x, sorted[k]) <= rhs; });
+						switch(co)
+							{
+							case eQuCoLt:	iEnd = iBelow;		break;
+							case eQuCoLte:	iEnd = iAtMost;		break;
+							case eQuCoGt:	iFirst = iAtMost;	break;
+							case eQuCoGte:	iFirst = iBelow;	break;
+							default:		iFirst = iBelow; iEnd = iAtMost;	break;
+							}
+						}
+					else
+						{
+						/* here the runs are of states not below rhs, and above it */
+						iBelow = first_failing(m, [&](size_t k) { return !(Apply(op, x, sorted[k]) < rhs); });
+						iAtMost = first_failing(m, [&](size_t k) { return !(Apply(op, x, sorted[k]) <= rhs); });
+						switch(co)
+							{
+							case eQuCoLt:	iFirst = iBelow;	break;
+							case eQuCoLte:	iFirst = iAtMost;	break;
+							case eQuCoGt:	iEnd = iAtMost;		break;
+							case eQuCoGte:	iEnd = iBelow;		break;
+							default:		iFirst = iAtMost; iEnd = iBelow;	break;
+							}
+						}
+					row.assign(order.begin()+iFirst, order.begin()+(iEnd > iFirst ? iEnd : iFirst));
+				}
+		/* The first k in 0..n for which pred fails, where it holds for a prefix */
+		template <typename _P>
+		static size_t first_failing(size_t n, _P pred)
+				{
+				size_t lo = 0, hi = n, mid;
+
+					while(lo < hi)
+						{
+						mid = lo + (hi-lo)/2;
+						if (pred(mid))	lo = mid+1;
+						else			hi = mid;
+						}
+					return lo;
+				}
+		static cbOperation oper_of(tQuOper op)
+				{
+					switch(op)
+						{
+						case eQuOpAdd:	return &CQuBit<_T>::qop_add;
+						case eQuOpSub:	return &CQuBit<_T>::qop_sub;
+						case eQuOpMul:	return &CQuBit<_T>::qop_mul;
+						case eQuOpDiv:	return &CQuBit<_T>::qop_div;
+						case eQuOpMod:	return &CQuBit<_T>::qop_mod;
+						case eQuOpBand:	return &CQuBit<_T>::qop_band;
+						case eQuOpBor:	return &CQuBit<_T>::qop_bor;
+						case eQuOpXor:	return &CQuBit<_T>::qop_xor;
+						case eQuOpLand:	return &CQuBit<_T>::qop_land;
+						case eQuOpLor:	return &CQuBit<_T>::qop_lor;
+						}
+					return &CQuBit<_T>::qop_add;
+				}
+		static cbCondOperation cond_of(tQuCond co)
+				{
+					switch(co)
+						{
+						case eQuCoLt:	return &CQuBit<_T>::qco_lt;
+						case eQuCoLte:	return &CQuBit<_T>::qco_lte;
+						case eQuCoGt:	return &CQuBit<_T>::qco_gt;
+						case eQuCoGte:	return &CQuBit<_T>::qco_gte;
+						case eQuCoEq:	return &CQuBit<_T>::qco_eq;
+						case eQuCoNeq:	return &CQuBit<_T>::qco_neq;
+						}
+					return &CQuBit<_T>::qco_eq;
+				}
+
+		/*
+		** Memoisation (see quCache.hpp)
+		** States are hashed by their bytes, so types that are not copied bit for
+		** bit are never cached, and these compile to nothing for them.
+		*/
+	static	bool	cache_enabled	(void)
+				{
+					if constexpr (is_trivially_copyable<_T>::value)
+						return CQuCache<_T>::Get().IsEnabled();
+					else
+						return false;
+				}
+		template <typename _CB>
+		static CQuCacheKey cache_key(tQuKind eKind, const CQuCacheOperand &lhs, const CQuCacheOperand &rhs, _CB cb)
+				{
+				CQuCacheKey key;
+
+					key.m_Lhs = lhs;
+					key.m_Rhs = rhs;
+					key.m_iOper = (uintptr_t)cb;
+					key.m_eKind = eKind;
+					return key;
+				}
+		/* GetFingerprint is fingerprint(0); the cache also checks another seed's */
+		uint64_t	fingerprint		(uint64_t iSeed) const
+				{
+				uint64_t h = QuMix64(((uint64_t)m_eType + 1) ^ iSeed);
+
+					h = QuHashBytes(m_qList.data(), m_qList.size()*sizeof(_T), h);
+					h = QuHashBytes(m_qWeights.data(), m_qWeights.size()*sizeof(double), h);
+					if (HasTolerance())
+						h = QuMix64(h ^ QuHashBytes(&m_fTolerance, sizeof(double), m_iUlps));
+					if (m_eType == eCollapsedResult)
+						{
+						h = QuMix64(h ^ ((uint64_t)m_eEigenType << 1 | m_bResult));
+						h = QuHashBytes(m_Eigenstates.data(), m_Eigenstates.size()*sizeof(_T), h);
+						}
+					return h;
+				}
+		CQuCacheOperand cache_operand(void) const
+				{
+					return CQuCacheOperand(GetFingerprint(), fingerprint(QUBIT_CACHE_CHECK_SEED), m_qList.size());
+				}
+	static	CQuCacheOperand cache_operand(const _T &v)
+				{
+					return CQuCacheOperand(GetFingerprint(v), QuHashBytes(&v, sizeof(_T), QUBIT_CACHE_CHECK_SEED), 1);
+				}
+		bool	cache_find		(const CQuCacheKey &key)
+				{
+					if constexpr (is_trivially_copyable<_T>::value)
+						return CQuCache<_T>::Get().Find(key, *this);
+					else
+						return false;
+				}
+		/* a cancelled job's results are incomplete */
+		void	cache_store		(const CQuCacheKey &key)
+				{
+					if constexpr (is_trivially_copyable<_T>::value)
+						if (!QuProgressCancelled())
+							CQuCache<_T>::Get().Store(key, *this);
+				}
+
+		/*
+		** Reduction Kernel
+		** Each thread folds its own contiguous chunk into four independent
+		** accumulators, one for each quarter of the chunk (so the folds can
+		** overlap), and the per-thread results are then combined pairwise, as
+		** a tree. Operands are only ever regrouped, never reordered, so an
+		** operator need only be associative.
+		*/
+		struct CQuRedMin		{ _T operator()(const _T &a, const _T &b) const { return b < a ? b : a; } };
+		struct CQuRedMax		{ _T operator()(const _T &a, const _T &b) const { return a < b ? b : a; } };
+		struct CQuRedSum		{ _T operator()(const _T &a, const _T &b) const { return a + b; } };
+		struct CQuRedProduct	{ _T operator()(const _T &a, const _T &b) const { return a * b; } };
+
+		template <typename _OP>
+		static _T reduce_chunk	(const _T *p, size_t n, _OP op, const _T &identity)
+				{
+				_T acc0 = identity, acc1 = identity, acc2 = identity, acc3 = identity;
+				size_t q = n/4, i;
+
+					for(i=0;i<q;i++)
+						{
+						acc0 = op(acc0, p[i]);
+						acc1 = op(acc1, p[q+i]);
+						acc2 = op(acc2, p[2*q+i]);
+						acc3 = op(acc3, p[3*q+i]);
+						}
+					/* the last quarter runs on to the end */
+					for(i=4*q;i<n;i++)
+						acc3 = op(acc3, p[i]);
+					return op(op(acc0, acc1), op(acc2, acc3));
+				}
+		template <typename _OP>
+		_T		reduce			(_OP op, const _T &identity) const
+				{
+				vector<_T> partial(QuChunkCount(GetCount(), QUBIT_PARALLEL_GRAIN), identity);
+				size_t iStep, i;
+
+					if (GetType() == eCollapsedResult || GetCount() == 0)
+						return identity;
+
+					QuParallelFor(GetCount(), QUBIT_PARALLEL_GRAIN,
+						[&](size_t iChunk, size_t iBegin, size_t iEnd)
+						{ partial[iChunk] = reduce_chunk(&m_qList[iBegin], iEnd-iBegin, op, identity); });
+
+					for(iStep=1;iStep<partial.size();iStep*=2)
+						for(i=0;i+iStep<partial.size();i+=2*iStep)
+							partial[i] = op(partial[i], partial[i+iStep]);
+					return partial[0];
+				}
+		/* The k first states in _CMP order, sorted. Each thread selects the best
+		   k of its own chunk, and the survivors are selected from once more. */
+		template <typename _CMP>
+		void	select			(size_t k, _CMP cmp, vector<_T> &out) const
+				{
+				size_t iCount = GetType()==eCollapsedResult ? 0 : GetCount();
+				size_t iChunks = QuChunkCount(iCount, QUBIT_PARALLEL_GRAIN);
+				vector<vector<_T> > partial(iChunks);
+				size_t i;
+
+					out.clear();
+					if (k > iCount)	k = iCount;
+					if (k == 0)		return;
+
+					/* splitting only pays while each chunk is much bigger than k */
+					if (iChunks > 1 && k*4 < iCount/iChunks)
+						{
+						QuParallelFor(iCount, QUBIT_PARALLEL_GRAIN,
+							[&](size_t iChunk, size_t iBegin, size_t iEnd)
+							{
+							vector<_T> &part = partial[iChunk];
+
+								part.assign(m_qList.begin()+iBegin, m_qList.begin()+iEnd);
+								if (k < part.size())
+									{
+									nth_element(part.begin(), part.begin()+k, part.end(), cmp);
+									part.resize(k);
+									}
+							});
+						for(i=0;i<partial.size();i++)
+							out.insert(out.end(), partial[i].begin(), partial[i].end());
+						}
+					else
+						out = m_qList;
+
+					if (k < out.size())
+						{
+						nth_element(out.begin(), out.begin()+k, out.end(), cmp);
+						out.resize(k);
+						}
+					sort(out.begin(), out.end(), cmp);
+				}
+
+		CQuBit<_T>	singleton	(const _T &v) const
+				{
+				CQuBit<_T> ans;
+
+					if (GetType() != eCollapsedResult && GetCount())
+						{
+						ans.m_qList.push_back(v);
+						ans.SetType(GetType());
+						}
+					return ans;
+				}
+
+		/* 
+		** Batch Kernel
+		** Inputs are processed in blocks of QUBIT_BATCH_ROWS, and the states in tiles
+		** of QUBIT_BATCH_TILE, so each tile is reused by every input in the block while
+		** it is still in cache. The inner loops are branch free over contiguous data,
+		** and so are left for the compiler to vectorise.
+		*/
+		void	do_batch_rows	(const vector<_T> &inputs, size_t iBegin, size_t iEnd, 
+								tQuOper op, tQuCond co, const _T &rhs, 
+								vector<CQuBit<_T> > &results, bool bEigenstates,
+								const vector<size_t> *pPrefix) const
+				{
+				tQuSuper eType = GetType()==eCollapsedResult ? eConj : GetType();
+				size_t iStates = GetType()==eCollapsedResult ? 0 : GetCount();
+				_T tile[QUBIT_BATCH_TILE];
+				unsigned char flags[QUBIT_BATCH_TILE];
+				unsigned char conj[QUBIT_BATCH_ROWS], disj[QUBIT_BATCH_ROWS];
+				size_t iLimit[QUBIT_BATCH_ROWS];
+				size_t iRow, iBlock, iRows, iTile, iSize, j;
+
+					for(iBlock=iBegin;iBlock<iEnd;iBlock+=QUBIT_BATCH_ROWS)
+						{
+						iRows = iEnd-iBlock < QUBIT_BATCH_ROWS ? iEnd-iBlock : QUBIT_BATCH_ROWS;
+						for(iRow=0;iRow<iRows;iRow++)
+							{
+							conj[iRow] = 1;
+							disj[iRow] = 0;
+							iLimit[iRow] = iStates;
+							if (pPrefix && iBlock+iRow < pPrefix->size() && (*pPrefix)[iBlock+iRow] < iStates)
+								iLimit[iRow] = (*pPrefix)[iBlock+iRow];
+							}
+
+						for(iTile=0;iTile<iStates;iTile+=QUBIT_BATCH_TILE)
+							for(iRow=0;iRow<iRows;iRow++)
+								{
+								if (iTile >= iLimit[iRow])
+									continue;
+								/* once the result is known, only eigenstates need more work */
+								if (!bEigenstates && (eType==eConj ? !conj[iRow] : disj[iRow]))
+									continue;
+
+								iSize = iLimit[iRow]-iTile < QUBIT_BATCH_TILE ? iLimit[iRow]-iTile : QUBIT_BATCH_TILE;
+								batch_oper(op, inputs[iBlock+iRow], &m_qList[iTile], iSize, tile);
+								batch_cond(co, tile, iSize, rhs, flags);
+
+								for(j=0;j<iSize;j++)
+									{
+									conj[iRow] &= flags[j];
+									disj[iRow] |= flags[j];
+									}
+
+								if (bEigenstates)
+									for(j=0;j<iSize;j++)
+										if (flags[j])
+											results[iBlock+iRow].AddEigenstate(tile[j]);
+								}
+
+						for(iRow=0;iRow<iRows;iRow++)
+							{
+							CQuBit<_T> &ans = results[iBlock+iRow];
+
+							ans.SetType(eCollapsedResult);
+							ans.m_eEigenType = eType;
+							ans.m_bResult = eType==eConj ? conj[iRow]!=0 : disj[iRow]!=0;
+							}
+						}
+				}
+
+		template <_T (*OP)(const _T &a, const _T &b)>
+		static void batch_row	(const _T &x, const _T *s, size_t n, _T *out)
+				{
+					for(size_t i=0;i<n;i++)
+						out[i] = OP(x, s[i]);
+				}
+		template <bool (*CO)(const _T &a, const _T &b)>
+		static void batch_test	(const _T *c, size_t n, const _T &rhs, unsigned char *flags)
+				{
+					for(size_t i=0;i<n;i++)
+						flags[i] = CO(c[i], rhs);
+				}
+		static void batch_oper	(tQuOper op, const _T &x, const _T *s, size_t n, _T *out)
+				{
+					switch(op)
+						{
+						case eQuOpAdd:	batch_row<&CQuBit<_T>::qop_add>(x, s, n, out);	break;
+						case eQuOpSub:	batch_row<&CQuBit<_T>::qop_sub>(x, s, n, out);	break;
+						case eQuOpMul:	batch_row<&CQuBit<_T>::qop_mul>(x, s, n, out);	break;
+						case eQuOpDiv:	batch_row<&CQuBit<_T>::qop_div>(x, s, n, out);	break;
+						case eQuOpMod:	batch_row<&CQuBit<_T>::qop_mod>(x, s, n, out);	break;
+						case eQuOpBand:	batch_row<&CQuBit<_T>::qop_band>(x, s, n, out);	break;
+						case eQuOpBor:	batch_row<&CQuBit<_T>::qop_bor>(x, s, n, out);	break;
+						case eQuOpXor:	batch_row<&CQuBit<_T>::qop_xor>(x, s, n, out);	break;
+						case eQuOpLand:	batch_row<&CQuBit<_T>::qop_land>(x, s, n, out);	break;
+						case eQuOpLor:	batch_row<&CQuBit<_T>::qop_lor>(x, s, n, out);	break;
+						}
+				}
+		static void batch_cond	(tQuCond co, const _T *c, size_t n, const _T &rhs, unsigned char *flags)
+				{
+					switch(co)
+						{
+						case eQuCoLt:	batch_test<&CQuBit<_T>::qco_lt>(c, n, rhs, flags);	break;
+						case eQuCoLte:	batch_test<&CQuBit<_T>::qco_lte>(c, n, rhs, flags);	break;
+						case eQuCoGt:	batch_test<&CQuBit<_T>::qco_gt>(c, n, rhs, flags);	break;
+						case eQuCoGte:	batch_test<&CQuBit<_T>::qco_gte>(c, n, rhs, flags);	break;
+						case eQuCoEq:	batch_test<&CQuBit<_T>::qco_eq>(c, n, rhs, flags);	break;
+						case eQuCoNeq:	batch_test<&CQuBit<_T>::qco_neq>(c, n, rhs, flags);	break;
+						}
+				}
+		void	AddEigenstate(const _T &e)
+				{
+				typename tQuStates::const_iterator it;
+
+					for(it=m_Eigenstates.begin();it!=m_Eigenstates.end();++it)
+						if (*it == e)
+							return;
+					m_Eigenstates.push_back(e);
+				}
+
 		bool	do_oper_int		(const CQuBit<_T> &a, const int &b, cbIntOperation cb)
 				{
-				typename vector<_T>::const_iterator it;
+				typename tQuStates::const_iterator it;
+				bool bCache = cache_enabled();
+				CQuCacheKey key;
+
+					QUBIT_STATS_SCOPE(eQuKindOperInt, a.GetCount());
+					QUBIT_TRACE_RESULT("do_oper_int", a.GetCount(), 1, this);
+					inherit_tolerance(a, a);
+					if (bCache)
+						{
+						key = cache_key(eQuKindOperInt, a.cache_operand(), CQuCacheOperand((uint64_t)b, (uint64_t)b, 1), cb);
+						if (cache_find(key))
+							return true;
+						}
 
-					for(it=a.m_qList.begin();it!=a.m_qList.end();++it)
-						Add(cb(*it, b));
+					m_Plan = plan_generate(eQuKindOperInt, a.GetCount(), 1, a.GetCount(), -1, a.IsWeighted(), false);
+					{
+					CQuAdder add(*this, m_Plan, a.IsWeighted(), _T(), _T(), a.GetCount());
+
+						for(it=a.m_qList.begin();it!=a.m_qList.end();++it)
+							add(cb(*it, b), a.GetWeight(it-a.m_qList.begin()));
+					}
 					
 					SetType(a.GetType());
 					
+					if (bCache)	cache_store(key);
+					
 					return true;
 				}
 
@@ -761,32 +2867,32 @@ inline _T			GetItem(size_t idx) const
 		*/
 		/* unary */
 		static _T qop_not(const _T &a) {	return !a; }
-		static _T qop_one(const _T &a) {	return ~a; }
-		static _T qop_neg(const _T &a) {	return -a; }
+		static _T qop_one(const _T &a) {	return CQuArith<_T>::Not(a); }
+		static _T qop_neg(const _T &a) {	return CQuWrap<_T>::Neg(a); }
 
 		/* binary */
 		static _T qop_neq(const _T &a, const _T &b) {	return a!=b; }
-		static _T qop_band(const _T &a, const _T &b) {	return a&b; }
-		static _T qop_bor(const _T &a, const _T &b) {	return a|b; }
+		static _T qop_band(const _T &a, const _T &b) {	return CQuArith<_T>::And(a,b); }
+		static _T qop_bor(const _T &a, const _T &b) {	return CQuArith<_T>::Or(a,b); }
 		static _T qop_land(const _T &a, const _T &b) {	return a&&b; }
 		static _T qop_lor(const _T &a, const _T &b) {	return a||b; }
 		/* binary (arithmetic) */
-		static _T qop_add(const _T &a, const _T &b) {	return a+b; }
-		static _T qop_sub(const _T &a, const _T &b) {	return a-b; }
+		static _T qop_add(const _T &a, const _T &b) {	return CQuWrap<_T>::Add(a,b); }
+		static _T qop_sub(const _T &a, const _T &b) {	return CQuWrap<_T>::Sub(a,b); }
 		static _T qop_mul(const _T &a, const _T &b) {	return a*b; }
 		static _T qop_div(const _T &a, const _T &b) {	return a/b; }
-		static _T qop_mod(const _T &a, const _T &b) {	return a%b; }
-		static _T qop_xor(const _T &a, const _T &b) {	return a^b; }
+		static _T qop_mod(const _T &a, const _T &b) {	return CQuArith<_T>::Mod(a,b); }
+		static _T qop_xor(const _T &a, const _T &b) {	return CQuArith<_T>::Xor(a,b); }
 		/* binary (shift) */
-		static _T qop_shlt(const _T &a, const _T &i) {	return a<<i; }
-		static _T qop_shrt(const _T &a, const _T &i) {	return a>>i; }
+		static _T qop_shlt(const _T &a, const _T &i) {	return CQuArith<_T>::Shl(a,(int)i); }
+		static _T qop_shrt(const _T &a, const _T &i) {	return CQuArith<_T>::Shr(a,(int)i); }
 		/* binary (inc/dev)
 		   In both cases here we are concerned about the 'value' of the
 		   variable - not a reference to it, as C++ would dictate for
 		   prefix increments, i.e. ++a or --b
 		*/
-		static _T qop_inc(const _T &a) { _T b=a; b++; return b; }	
-		static _T qop_dec(const _T &a) { _T b=a; b--; return b; }
+		static _T qop_inc(const _T &a) { return CQuWrap<_T>::Inc(a); }
+		static _T qop_dec(const _T &a) { return CQuWrap<_T>::Dec(a); }
 		/* binary (comparisons) */
 		static bool qco_lte(const _T &a, const _T &b) { return a<=b; }
 		static bool qco_lt(const _T &a, const _T &b) { return a<b; }
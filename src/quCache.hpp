@@ -0,0 +1,222 @@
+#ifndef QUCACHE_H
+#define QUCACHE_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Memoisation of superposition operations
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <cstring>
+#include <type_traits>
+#include <stdint.h>
+
+using namespace std;
+
+template <typename _T> class CQuBit;
+
+
+/*
+** Content fingerprints. Order matters, since operations preserve the order
+** of their operands' states, and so two superpositions only share a
+** fingerprint if they would produce the same results.
+*/
+inline uint64_t QuMix64(uint64_t x)
+{
+	x ^= x >> 30;	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+inline uint64_t QuHashBytes(const void *pData, size_t iBytes, uint64_t iSeed)
+{
+const unsigned char *p = (const unsigned char *)pData;
+uint64_t h = QuMix64(iSeed ^ iBytes), w;
+
+	for(;iBytes>=8;iBytes-=8,p+=8)
+		{
+		memcpy(&w, p, 8);
+		h = QuMix64(h ^ w) + 0x9e3779b97f4a7c15ULL;
+		}
+	if (iBytes)
+		{
+		w = 0;
+		memcpy(&w, p, iBytes);
+		h = QuMix64(h ^ w ^ 0xff);
+		}
+	return h;
+}
+
+/* Seeds the second, independent hash of each operand, which a hit must also match */
+#define QUBIT_CACHE_CHECK_SEED	0x5851f42d4c957f2dULL
+
+
+/*
+** One operand, as the cache tells it apart: its fingerprint, a second hash
+** of the same contents from another seed, and its number of states. Two
+** operands are only taken to be the same if all three agree, so a result
+** is not handed back for the wrong operands unless 128 bits of hash collide
+** between superpositions of the same size.
+*/
+struct CQuCacheOperand {
+	uint64_t	m_iHash;
+	uint64_t	m_iCheck;
+	uint64_t	m_iCount;
+
+	CQuCacheOperand(uint64_t iHash = 0, uint64_t iCheck = 0, uint64_t iCount = 0) :
+		m_iHash(iHash), m_iCheck(iCheck), m_iCount(iCount) {}
+
+	/* This operand and another, as one (e.g. Where's right hand operand and bound) */
+	CQuCacheOperand With(const CQuCacheOperand &o) const
+		{ return CQuCacheOperand(QuMix64(m_iHash ^ o.m_iHash), QuMix64(m_iCheck + QuMix64(o.m_iCheck)), m_iCount); }
+
+	bool operator==(const CQuCacheOperand &o) const
+		{ return m_iHash==o.m_iHash && m_iCheck==o.m_iCheck && m_iCount==o.m_iCount; }
+};
+
+
+/*
+** Cache Key
+** One operation: its kind, the operator callback it ran, and both operands
+** (a scalar operand is hashed by value).
+*/
+typedef enum { eQuKindOper, eQuKindOperType, eQuKindTypeOper, eQuKindUnary, eQuKindIncDec,
+			   eQuKindCondition, eQuKindConditionType, eQuKindOperInt,
+			   eQuKindSetAny, eQuKindSetAll, eQuKindWhere, eQuKindCount, } tQuKind;
+
+struct CQuCacheKey {
+	CQuCacheOperand	m_Lhs;
+	CQuCacheOperand	m_Rhs;
+	uintptr_t		m_iOper;
+	tQuKind			m_eKind;
+
+	bool operator==(const CQuCacheKey &k) const
+		{ return m_Lhs==k.m_Lhs && m_Rhs==k.m_Rhs && m_iOper==k.m_iOper && m_eKind==k.m_eKind; }
+};
+
+struct CQuCacheKeyHash {
+	size_t operator()(const CQuCacheKey &k) const
+		{ return (size_t)QuMix64(k.m_Lhs.m_iHash ^ QuMix64(k.m_Rhs.m_iHash ^ QuMix64(k.m_iOper + k.m_eKind))); }
+};
+
+
+/*
+** Opt-in, size-bounded LRU cache of operation results, one per CQuBit type.
+** The capacity is measured in stored states (including eigenstates), so a
+** handful of huge results cannot pin unbounded memory. A capacity of 0 (the
+** default) disables it. States are hashed by their bytes, so only types
+** that are copied bit for bit can be cached; CQuBit never consults the
+** cache for others, and it can not be switched on for them.
+*/
+template <typename _T>
+class CQuCache {
+
+	public:
+		CQuCache() { m_iCapacity = m_iSize = m_iHits = m_iMisses = 0; }
+
+		static CQuCache<_T> &Get(void)
+					{
+					static CQuCache<_T> cache;
+
+						return cache;
+					}
+
+		void		SetCapacity(size_t iStates)
+					{
+					static_assert(is_trivially_copyable<_T>::value, "CQuCache hashes states by their bytes");
+					lock_guard<mutex> lock(m_Lock);
+
+						m_iCapacity = iStates;
+						trim();
+					}
+inline	size_t		GetCapacity(void) const	{ return m_iCapacity; }
+inline	bool		IsEnabled(void) const	{ return m_iCapacity != 0; }
+		void		Clear(void)
+					{
+					lock_guard<mutex> lock(m_Lock);
+
+						m_Entries.clear();
+						m_Index.clear();
+						m_iSize = 0;
+					}
+		void		ResetCounters(void)
+					{
+					lock_guard<mutex> lock(m_Lock);
+
+						m_iHits = m_iMisses = 0;
+					}
+
+		/*
+		** Tuning
+		*/
+inline	size_t		GetHits(void) const		{ return m_iHits; }
+inline	size_t		GetMisses(void) const	{ return m_iMisses; }
+inline	size_t		GetSize(void) const		{ return m_iSize; }
+inline	size_t		GetEntries(void) const	{ return m_Index.size(); }
+
+		/* Copies a previously stored result into 'result', and marks it recently used */
+		bool		Find(const CQuCacheKey &key, CQuBit<_T> &result)
+					{
+					lock_guard<mutex> lock(m_Lock);
+					typename tIndex::iterator it = m_Index.find(key);
+
+						if (it == m_Index.end())
+							{
+							m_iMisses++;
+							return false;
+							}
+
+						m_iHits++;
+						m_Entries.splice(m_Entries.begin(), m_Entries, it->second);
+						result = it->second->second;
+						return true;
+					}
+		void		Store(const CQuCacheKey &key, const CQuBit<_T> &result)
+					{
+					lock_guard<mutex> lock(m_Lock);
+					size_t iSize = result.GetCount() + result.GetEigenCount();
+
+						if (iSize > m_iCapacity || m_Index.find(key) != m_Index.end())
+							return;
+
+						m_Entries.push_front(tEntry(key, result));
+						m_Index[key] = m_Entries.begin();
+						m_iSize += iSize;
+						trim();
+					}
+
+	private:
+		typedef pair<CQuCacheKey, CQuBit<_T> >	tEntry;
+		typedef typename list<tEntry>::iterator	tEntryIt;
+		typedef unordered_map<CQuCacheKey, tEntryIt, CQuCacheKeyHash> tIndex;
+
+		/* Called with the lock held */
+		void		trim(void)
+					{
+						while(m_iSize > m_iCapacity && !m_Entries.empty())
+							{
+							tEntry &e = m_Entries.back();
+
+							m_iSize -= e.second.GetCount() + e.second.GetEigenCount();
+							m_Index.erase(e.first);
+							m_Entries.pop_back();
+							}
+					}
+
+		list<tEntry>	m_Entries;		/* most recently used first */
+		tIndex			m_Index;
+		size_t			m_iCapacity;
+		size_t			m_iSize;
+		size_t			m_iHits;
+		size_t			m_iMisses;
+		mutex			m_Lock;
+};
+
+
+#endif	// QUCACHE_H
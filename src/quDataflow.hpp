@@ -0,0 +1,333 @@
+#ifndef QUDATAFLOW_H
+#define QUDATAFLOW_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Incrementally maintained superpositions
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include "quBit.hpp"
+
+using namespace std;
+
+
+/*
+** A CQuNode holds a superposition that other nodes may subscribe to. When
+** states are added to, or removed from, a CQuSource, only those states are
+** passed on to its subscribers, which adjust their own results and pass
+** on whatever changed in turn. The cost of an update is therefore in
+** proportion to the change, rather than to the size of the superpositions.
+**
+** e.g.
+**	CQuSource<int> base(big);
+**	CQuMapNode<int> scaled(base, eQuOpMul, 3);			// base * 3
+**	CQuConditionNode<int> small(scaled, eQuCoLt, 100);	// (base * 3) < 100
+**	base.Add(7);	// updates scaled and small.GetBoolResult() in O(1)
+**
+** Nodes must be destroyed before the nodes they subscribe to, and can not
+** be copied, as their inputs hold their address. Removing a
+** state moves the last state into its place, so derived superpositions keep
+** the same states as a full re-evaluation, but not necessarily in the same
+** order. Like CQuBit itself, a graph must only be used from one thread.
+*/
+template <typename _T>
+class CQuNode {
+
+	public:
+		CQuNode()			{}
+		CQuNode(const CQuNode<_T> &) = delete;
+		virtual ~CQuNode()	{}
+
+		CQuNode<_T> &		operator=(const CQuNode<_T> &) = delete;
+
+		/* The current superposition. Note that it is only valid until the next update */
+		const CQuBit<_T> &	Get(void) const			{ return m_Value; }
+inline	size_t				GetCount(void) const	{ return m_Value.m_qList.size(); }
+inline	bool				Contains(const _T &v) const { return m_Index.find(v) != m_Index.end(); }
+
+		void		Subscribe(CQuNode<_T> *pNode)	{ m_Subscribers.push_back(pNode); }
+		void		Unsubscribe(CQuNode<_T> *pNode)
+					{
+					typename vector<CQuNode<_T> *>::iterator it;
+
+						it = find(m_Subscribers.begin(), m_Subscribers.end(), pNode);
+						if (it != m_Subscribers.end())
+							m_Subscribers.erase(it);
+					}
+
+	protected:
+		/* Deltas arriving from a node this one subscribes to */
+		virtual void	OnInsert(const CQuNode<_T> *, const _T &)	{}
+		virtual void	OnErase(const CQuNode<_T> *, const _T &)	{}
+
+		/* Changes to this node's own superposition, which are passed on */
+		bool		insert(const _T &v)
+					{
+					size_t i;
+
+						if (Contains(v))
+							return false;
+
+						m_Index[v] = m_Value.m_qList.size();
+						m_Value.m_qList.push_back(v);
+						m_Value.touch();
+						for(i=0;i<m_Subscribers.size();i++)
+							m_Subscribers[i]->OnInsert(this, v);
+						return true;
+					}
+		bool		erase(const _T &v)
+					{
+					typename unordered_map<_T, size_t>::iterator it = m_Index.find(v);
+					size_t iPos, i;
+
+						if (it == m_Index.end())
+							return false;
+
+						iPos = it->second;
+						m_Index.erase(it);
+						if (iPos+1 != m_Value.m_qList.size())
+							{
+							m_Value.m_qList[iPos] = m_Value.m_qList.back();
+							m_Index[m_Value.m_qList[iPos]] = iPos;
+							}
+						m_Value.m_qList.pop_back();
+						m_Value.touch();
+
+						for(i=0;i<m_Subscribers.size();i++)
+							m_Subscribers[i]->OnErase(this, v);
+						return true;
+					}
+		void		copy_type(const CQuNode<_T> &from)	{ m_Value.m_eType = from.m_Value.m_eType; }
+		void		set_disj(void)						{ m_Value.m_eType = CQuBit<_T>::eDisj; }
+	static	bool	is_disj(const CQuNode<_T> &n)		{ return n.m_Value.m_eType == CQuBit<_T>::eDisj; }
+	static	const typename CQuBit<_T>::tQuStates &states(const CQuNode<_T> &n)	{ return n.m_Value.m_qList; }
+
+		void		reserve(size_t i)
+					{
+						m_Value.m_qList.reserve(i);
+						m_Index.reserve(i);
+					}
+		void		set_value(const CQuBit<_T> &q)
+					{
+					size_t i;
+
+						m_Value = q;
+						m_Index.clear();
+						m_Index.reserve(q.GetCount());
+						for(i=0;i<m_Value.m_qList.size();i++)
+							m_Index[m_Value.m_qList[i]] = i;
+					}
+
+		CQuBit<_T>					m_Value;
+		unordered_map<_T, size_t>	m_Index;		/* position of each state in m_Value */
+		vector<CQuNode<_T> *>		m_Subscribers;
+};
+
+
+/*
+** The base superposition, which is edited directly
+*/
+template <typename _T>
+class CQuSource : public CQuNode<_T> {
+
+	public:
+		CQuSource()							{}
+		CQuSource(const CQuBit<_T> &q)		{ this->set_value(q); }
+
+		bool		Add(const _T &v)		{ return this->insert(v); }
+		bool		Remove(const _T &v)		{ return this->erase(v); }
+		bool		AddRange(_T iFirst, _T iLast, float iStep=1)
+					{
+					bool rt=true;
+
+						for(_T i=iFirst;i<=iLast;i+=(_T)iStep)
+							rt &= Add(i);
+						return rt;
+					}
+};
+
+
+/*
+** (input OP k), or (k OP input). Several inputs may map to the same
+** result, so each result state counts the inputs that produce it.
+*/
+template <typename _T>
+class CQuMapNode : public CQuNode<_T> {
+
+	public:
+		CQuMapNode(CQuNode<_T> &in, tQuOper op, const _T &k, bool bScalarLeft=false)
+				: m_pIn(&in), m_eOp(op), m_K(k), m_bScalarLeft(bScalarLeft)
+					{
+					size_t i;
+
+						this->copy_type(in);
+						this->reserve(in.GetCount());
+						for(i=0;i<in.GetCount();i++)
+							OnInsert(&in, this->states(in)[i]);
+						in.Subscribe(this);
+					}
+		~CQuMapNode()	{ m_pIn->Unsubscribe(this); }
+
+	protected:
+		_T			map(const _T &v) const
+					{ return m_bScalarLeft ? CQuBit<_T>::Apply(m_eOp, m_K, v) : CQuBit<_T>::Apply(m_eOp, v, m_K); }
+
+		void		OnInsert(const CQuNode<_T> *, const _T &v)
+					{
+					_T r = map(v);
+
+						if (m_Uses[r]++ == 0)
+							this->insert(r);
+					}
+		void		OnErase(const CQuNode<_T> *, const _T &v)
+					{
+					typename unordered_map<_T, size_t>::iterator it = m_Uses.find(map(v));
+
+						if (it != m_Uses.end() && --it->second == 0)
+							{
+							_T r = it->first;
+
+							m_Uses.erase(it);
+							this->erase(r);
+							}
+					}
+
+		CQuNode<_T> *				m_pIn;
+		tQuOper						m_eOp;
+		_T							m_K;
+		bool						m_bScalarLeft;
+		unordered_map<_T, size_t>	m_Uses;
+};
+
+
+/*
+** (input COND k). The node's superposition holds the eigenstates, so it can
+** be fed to further nodes, and GetBoolResult() gives the collapsed result.
+*/
+template <typename _T>
+class CQuConditionNode : public CQuNode<_T> {
+
+	public:
+		CQuConditionNode(CQuNode<_T> &in, tQuCond co, const _T &k)
+				: m_pIn(&in), m_eCond(co), m_K(k)
+					{
+					size_t i;
+
+						this->copy_type(in);
+						for(i=0;i<in.GetCount();i++)
+							OnInsert(&in, this->states(in)[i]);
+						in.Subscribe(this);
+					}
+		~CQuConditionNode()	{ m_pIn->Unsubscribe(this); }
+
+		/* As (in COND k).GetBoolResult() */
+		bool		GetBoolResult(void) const
+					{
+						if (this->is_disj(*m_pIn))
+							return this->GetCount() != 0;
+						return this->GetCount() == m_pIn->GetCount();
+					}
+		/* As (in COND k).Eigenstates() */
+		CQuBit<_T>	Eigenstates(void) const			{ return this->Get(); }
+
+	protected:
+		void		OnInsert(const CQuNode<_T> *, const _T &v)
+					{
+						if (CQuBit<_T>::Compare(m_eCond, v, m_K))
+							this->insert(v);
+					}
+		void		OnErase(const CQuNode<_T> *, const _T &v)
+					{
+						this->erase(v);
+					}
+
+		CQuNode<_T> *	m_pIn;
+		tQuCond			m_eCond;
+		_T				m_K;
+};
+
+
+/*
+** Any(a, b) and All(a, b): union and intersection of two nodes. A node may
+** be given as both, e.g. Any(a, a), which is then just a copy of it.
+*/
+template <typename _T>
+class CQuUnionNode : public CQuNode<_T> {
+
+	public:
+		CQuUnionNode(CQuNode<_T> &a, CQuNode<_T> &b) : m_pA(&a), m_pB(&b)
+					{
+					size_t i;
+
+						for(i=0;i<a.GetCount();i++)
+							this->insert(this->states(a)[i]);
+						for(i=0;i<b.GetCount();i++)
+							this->insert(this->states(b)[i]);
+						this->set_disj();
+						a.Subscribe(this);
+						if (m_pB != m_pA)
+							b.Subscribe(this);
+					}
+		~CQuUnionNode()
+					{
+						m_pA->Unsubscribe(this);
+						if (m_pB != m_pA)
+							m_pB->Unsubscribe(this);
+					}
+
+	protected:
+		/* A state is only new (or gone) if the other side does not have it, unless
+		   there is no other side, in which case every change is passed straight on */
+		void		OnInsert(const CQuNode<_T> *pFrom, const _T &v)
+					{
+						if (m_pA == m_pB || !(pFrom == m_pA ? m_pB : m_pA)->Contains(v))
+							this->insert(v);
+					}
+		void		OnErase(const CQuNode<_T> *pFrom, const _T &v)
+					{
+						if (m_pA == m_pB || !(pFrom == m_pA ? m_pB : m_pA)->Contains(v))
+							this->erase(v);
+					}
+
+		CQuNode<_T> *	m_pA;
+		CQuNode<_T> *	m_pB;
+};
+
+template <typename _T>
+class CQuIntersectionNode : public CQuNode<_T> {
+
+	public:
+		CQuIntersectionNode(CQuNode<_T> &a, CQuNode<_T> &b) : m_pA(&a), m_pB(&b)
+					{
+					size_t i;
+
+						for(i=0;i<a.GetCount();i++)
+							OnInsert(&a, this->states(a)[i]);
+						a.Subscribe(this);
+						b.Subscribe(this);
+					}
+		~CQuIntersectionNode()	{ m_pA->Unsubscribe(this); m_pB->Unsubscribe(this); }
+
+	protected:
+		void		OnInsert(const CQuNode<_T> *pFrom, const _T &v)
+					{
+						if ((pFrom == m_pA ? m_pB : m_pA)->Contains(v))
+							this->insert(v);
+					}
+		void		OnErase(const CQuNode<_T> *, const _T &v)
+					{
+						this->erase(v);
+					}
+
+		CQuNode<_T> *	m_pA;
+		CQuNode<_T> *	m_pB;
+};
+
+
+#endif	// QUDATAFLOW_H
@@ -0,0 +1,99 @@
+#ifndef QUFFT_H
+#define QUFFT_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Sumsets by fast Fourier transform
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <vector>
+#include <complex>
+#include <cmath>
+
+using namespace std;
+
+
+/*
+** In-place iterative radix-2 FFT. The size must be a power of 2. The
+** inverse is unscaled, so divide by the size afterwards.
+*/
+inline void QuFFT(vector<complex<double> > &x, bool bInverse)
+{
+size_t n = x.size(), i, j, k, iLen, iHalf;
+vector<complex<double> > twiddle(n/2);
+complex<double> t;
+double fSign = bInverse ? 1.0 : -1.0;
+
+	for(i=0;i<n/2;i++)
+		twiddle[i] = complex<double>(cos(2*M_PI*i/n), fSign*sin(2*M_PI*i/n));
+
+	/* bit reversed order */
+	for(i=1,j=0;i<n;i++)
+		{
+		for(k=n>>1;j&k;k>>=1)
+			j ^= k;
+		j ^= k;
+		if (i < j)
+			swap(x[i], x[j]);
+		}
+
+	for(iLen=2;iLen<=n;iLen<<=1)
+		{
+		iHalf = iLen >> 1;
+		for(i=0;i<n;i+=iLen)
+			for(j=0;j<iHalf;j++)
+				{
+				t = x[i+j+iHalf] * twiddle[j * (n/iLen)];
+				x[i+j+iHalf] = x[i+j] - t;
+				x[i+j] += t;
+				}
+		}
+}
+
+/*
+** Which sums a+b occur, for a and b given as 0/1 indicators over the
+** offsets 0..n-1 and 0..m-1: on return, present[k] is 1 if some a+b is k,
+** for k = 0..n+m-2. Both indicators share one complex transform.
+*/
+inline void QuSumset(const vector<unsigned char> &a, const vector<unsigned char> &b, vector<unsigned char> &present)
+{
+size_t iOut = a.size() + b.size() - 1, n = 1, i;
+vector<complex<double> > x, p;
+complex<double> xa, xb, xk, xnk;
+
+	present.clear();
+	if (a.empty() || b.empty())
+		return;
+	while(n < iOut)
+		n <<= 1;
+
+	x.assign(n, complex<double>(0, 0));
+	for(i=0;i<a.size();i++)
+		x[i].real(a[i]);
+	for(i=0;i<b.size();i++)
+		x[i].imag(b[i]);
+	QuFFT(x, false);
+
+	/* separate the two real transforms, and multiply them */
+	p.resize(n);
+	for(i=0;i<n;i++)
+		{
+		xk = x[i];
+		xnk = conj(x[(n-i) & (n-1)]);
+		xa = (xk + xnk) * 0.5;
+		xb = (xk - xnk) * complex<double>(0, -0.5);
+		p[i] = xa * xb;
+		}
+	QuFFT(p, true);
+
+	/* the counts are whole numbers, give or take rounding */
+	present.resize(iOut);
+	for(i=0;i<iOut;i++)
+		present[i] = p[i].real() / n > 0.5;
+}
+
+
+#endif	// QUFFT_H
@@ -0,0 +1,450 @@
+#ifndef QUFIXED_H
+#define QUFIXED_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Fixed capacity superpositions, for use in constant expressions
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <type_traits>
+#include <limits>
+#include <initializer_list>
+#include <cstddef>
+#include "quBit.hpp"
+
+using namespace std;
+
+
+/*
+** A CQuBitFixed holds at most N states, in place, so it needs no heap and
+** every method may be evaluated at compile time. Superpositions known in
+** advance (small prime tables, ranges like CQuBit<float>(2,10)) can then be
+** folded into constants, e.g.
+**
+**	constexpr CQuBitFixed<int, 9> ltt(2, 10);
+**	static_assert((ltt * 3 < 40).GetBoolResult(), "");
+**
+** The results of operations are sized from their operands: a superposition
+** combined with a scalar keeps the capacity N, two combined pairwise have
+** room for every pairing (N*M), Any(a,b) for both (N+M), and All(a,b) for
+** the larger of the two (max(N,M)). Add returns false once a superposition
+** is full. The behaviour otherwise follows CQuBit; ToQuBit gives the
+** equivalent run-time superposition.
+*/
+/* The superposition types, shared by every capacity */
+struct CQuFixedBase {
+	typedef enum { eConj, eDisj, eCollapsedResult, } tQuSuper;
+};
+
+template <typename _T, size_t N>
+class CQuBitFixed : public CQuFixedBase {
+
+	static_assert(N > 0, "a CQuBitFixed must have room for at least one state");
+
+	template <typename _U, size_t M> friend class CQuBitFixed;
+
+	public:
+		constexpr CQuBitFixed() : m_qList(), m_iCount(0), m_eType(eConj), m_eEigenType(eConj), m_bResult(false) {}
+		constexpr CQuBitFixed(_T a, _T b, _T s=1)		// Construct a range
+					: m_qList(), m_iCount(0), m_eType(eConj), m_eEigenType(eConj), m_bResult(false)
+					{
+						AddRange(a, b, s);
+					}
+		constexpr CQuBitFixed(initializer_list<_T> items)
+					: m_qList(), m_iCount(0), m_eType(eConj), m_eEigenType(eConj), m_bResult(false)
+					{
+					const _T *it = 0;
+
+						for(it=items.begin();it!=items.end();++it)
+							Add(*it);
+					}
+
+		/*
+		** Quantum States
+		*/
+		constexpr void		Clear(void)		{ m_iCount = 0; }
+		constexpr bool		Add(_T iNewItem)
+					{
+					size_t i = 0;
+
+						/* add if unique, and there is room */
+						for(i=0;i<m_iCount;i++)
+							if (m_qList[i] == iNewItem)
+								return false;
+						if (m_iCount == N)
+							return false;
+
+						m_qList[m_iCount++] = iNewItem;
+						return true;
+					}
+		constexpr bool		AddRange(_T iFirst, _T iLast, _T iStep=1)
+					{
+					bool rt=true;
+
+						for(_T i=iFirst;i<=iLast;i+=iStep)
+							rt &= Add(i);
+						return rt;
+					}
+		constexpr bool		Remove(_T iOldItem)
+					{
+					size_t i = 0, j = 0;
+
+						for(i=0;i<m_iCount;i++)
+							if (m_qList[i] == iOldItem)
+								{
+								for(j=i+1;j<m_iCount;j++)
+									m_qList[j-1] = m_qList[j];
+								m_iCount--;
+								return true;
+								}
+						return false;
+					}
+
+		/* A collapsed result holds no states, only its eigenstates */
+		constexpr size_t	GetCount(void) const		{ return m_eType == eCollapsedResult ? 0 : m_iCount; }
+		constexpr size_t	GetEigenCount(void) const	{ return m_eType == eCollapsedResult ? m_iCount : 0; }
+	static constexpr size_t	GetCapacity(void)			{ return N; }
+		constexpr _T		GetItem(size_t idx) const
+					{
+					return idx < GetCount() ? m_qList[idx] : (_T)0;
+					}
+		constexpr const _T	operator[](size_t idx) const { return GetItem(idx); }
+
+		/*
+		** Quantum Operations
+		*/
+		constexpr CQuBitFixed<_T, N>	Any(void) const
+					{
+					CQuBitFixed<_T, N> any = *this;
+
+						any.m_eType = eDisj;
+						return any;
+					}
+		constexpr CQuBitFixed<_T, N>	All(void) const
+					{
+					CQuBitFixed<_T, N> all = *this;
+
+						all.m_eType = eConj;
+						return all;
+					}
+		template <size_t M>
+		constexpr CQuBitFixed<_T, N+M>	Any(const CQuBitFixed<_T, M> &b) const		/*union*/
+					{
+					CQuBitFixed<_T, N+M> ans;
+					size_t i = 0;
+
+						for(i=0;i<GetCount();i++)
+							ans.Add(m_qList[i]);
+						for(i=0;i<b.GetCount();i++)
+							ans.Add(b.m_qList[i]);
+						ans.m_eType = eDisj;
+						return ans;
+					}
+		/* Sized for the larger operand, since a collapsed side gives the other one
+		   back whole, as a conjunction (and without states, if it too collapsed) */
+		template <size_t M>
+		constexpr CQuBitFixed<_T, (N > M ? N : M)>	All(const CQuBitFixed<_T, M> &b) const		/*intersection*/
+					{
+					CQuBitFixed<_T, (N > M ? N : M)> ans;
+					size_t i = 0, j = 0;
+
+						if (m_eType == eCollapsedResult)
+							ans = b.template resize<(N > M ? N : M)>();
+						else if (b.m_eType == eCollapsedResult)
+							ans = resize<(N > M ? N : M)>();
+						else
+							{
+							for(i=0;i<m_iCount;i++)
+								for(j=0;j<b.m_iCount;j++)
+									if (m_qList[i] == b.m_qList[j])
+										ans.Add(m_qList[i]);
+							}
+
+						/* a collapsed result's eigenstates are not states */
+						if (ans.m_eType == eCollapsedResult)
+							ans.m_iCount = 0;
+						ans.m_eType = eConj;
+						return ans;
+					}
+
+		constexpr CQuBitFixed<_T, N>	Eigenstates(void) const
+					{
+					CQuBitFixed<_T, N> e;
+
+						if (m_eType == eCollapsedResult)
+							{
+							e = *this;
+							e.m_eType = m_eEigenType;
+							}
+						return e;
+					}
+		constexpr tQuSuper	GetType(void) const			{ return m_eType; }
+		constexpr bool		GetBoolResult(void) const	{ return m_bResult; }
+
+		/* The equivalent run-time superposition */
+		CQuBit<_T>			ToQuBit(void) const
+					{
+					CQuBit<_T> q;
+					size_t i = 0;
+
+						for(i=0;i<GetCount();i++)
+							q.Add(m_qList[i]);
+						return m_eType == eDisj ? q.Any() : q.All();
+					}
+		_T					Observe(void) const
+					{
+						if (GetCount() == 0) { return (_T)0; }
+						return m_qList[CQuRandom::Local().NextIndex(GetCount())];
+					}
+
+		/*
+		** Overloads
+		*/
+		constexpr CQuBitFixed<_T, N> operator!(void) const	{ return unary(eQuFixNot); }
+		constexpr CQuBitFixed<_T, N> operator~(void) const	{ return unary(eQuFixOne); }
+		constexpr CQuBitFixed<_T, N> operator-(void) const	{ return unary(eQuFixNeg); }
+
+#define QUFIXED_OPERATOR(OP, ID)																\
+		template <size_t M>																		\
+		constexpr CQuBitFixed<_T, N*M> operator OP(const CQuBitFixed<_T, M> &rhs) const			\
+			{ return oper(rhs, ID); }															\
+		constexpr CQuBitFixed<_T, N> operator OP(const _T &rhs) const							\
+			{ return oper_type(rhs, ID, false); }												\
+		friend constexpr CQuBitFixed<_T, N> operator OP(const _T &a, const CQuBitFixed<_T, N> &b)	\
+			{ return b.oper_type(a, ID, true); }
+
+		QUFIXED_OPERATOR(+, eQuOpAdd)
+		QUFIXED_OPERATOR(-, eQuOpSub)
+		QUFIXED_OPERATOR(*, eQuOpMul)
+		QUFIXED_OPERATOR(/, eQuOpDiv)
+		QUFIXED_OPERATOR(%, eQuOpMod)
+		QUFIXED_OPERATOR(&, eQuOpBand)
+		QUFIXED_OPERATOR(|, eQuOpBor)
+		QUFIXED_OPERATOR(^, eQuOpXor)
+		QUFIXED_OPERATOR(&&, eQuOpLand)
+		QUFIXED_OPERATOR(||, eQuOpLor)
+#undef QUFIXED_OPERATOR
+
+		constexpr CQuBitFixed<_T, N> operator<<(const int &rhs) const	{ return shift(rhs, true); }
+		constexpr CQuBitFixed<_T, N> operator>>(const int &rhs) const	{ return shift(rhs, false); }
+
+#define QUFIXED_CONDITION(OP, ID)																\
+		template <size_t M>																		\
+		constexpr CQuBitFixed<_T, N> operator OP(const CQuBitFixed<_T, M> &rhs) const			\
+			{ return condition(rhs, ID); }														\
+		constexpr CQuBitFixed<_T, N> operator OP(const _T &rhs) const							\
+			{ return condition_type(rhs, ID); }
+
+		QUFIXED_CONDITION(<, eQuCoLt)
+		QUFIXED_CONDITION(<=, eQuCoLte)
+		QUFIXED_CONDITION(>, eQuCoGt)
+		QUFIXED_CONDITION(>=, eQuCoGte)
+		QUFIXED_CONDITION(==, eQuCoEq)
+		QUFIXED_CONDITION(!=, eQuCoNeq)
+#undef QUFIXED_CONDITION
+
+	friend  ostream &operator<<(ostream &os, const CQuBitFixed<_T, N> &q)
+			{
+				return os << q.ToQuBit();
+			}
+
+		/*
+		** Operators, as CQuBit::Apply and CQuBit::Compare but usable at compile
+		** time. Bitwise operators on floating point types work on the integer part.
+		*/
+	static constexpr _T		Apply(tQuOper op, const _T &a, const _T &b)
+					{
+						switch(op)
+							{
+							case eQuOpAdd:	return a+b;
+							case eQuOpSub:	return a-b;
+							case eQuOpMul:	return a*b;
+							case eQuOpDiv:	return a/b;
+							case eQuOpMod:
+								if constexpr (is_integral<_T>::value)
+									return a%b;
+								else
+									return modulo(a, b);
+							case eQuOpBand:	return (_T)(integer(a) & integer(b));
+							case eQuOpBor:	return (_T)(integer(a) | integer(b));
+							case eQuOpXor:	return (_T)(integer(a) ^ integer(b));
+							case eQuOpLand:	return a&&b;
+							case eQuOpLor:	return a||b;
+							}
+						return (_T)0;
+					}
+	static constexpr bool	Compare(tQuCond co, const _T &a, const _T &b)
+					{
+						switch(co)
+							{
+							case eQuCoLt:	return a<b;
+							case eQuCoLte:	return a<=b;
+							case eQuCoGt:	return a>b;
+							case eQuCoGte:	return a>=b;
+							case eQuCoEq:	return a==b;
+							case eQuCoNeq:	return a!=b;
+							}
+						return false;
+					}
+
+	private:
+		typedef enum { eQuFixNot, eQuFixOne, eQuFixNeg, } tQuFixUnary;
+		typedef typename conditional<is_integral<_T>::value, _T, long long>::type tInteger;
+
+	static constexpr tInteger integer(const _T &a)	{ return (tInteger)a; }
+	/* fmod, exactly. b doubled up to a, then halved back down, is taken off
+	   wherever it fits; each such subtraction is exact, as is each doubling. */
+	static constexpr _T		modulo(const _T &a, const _T &b)
+					{
+					_T r = a < 0 ? -a : a, d = b < 0 ? -b : b, t = 0;
+
+						if (a != a || b != b || d == 0 || r == numeric_limits<_T>::infinity())
+							return numeric_limits<_T>::quiet_NaN();
+						if (r < d)
+							return a;
+						for(t=d;t*2 <= r;t*=2)
+							;
+						for(;t >= d;t/=2)
+							if (r >= t)
+								r -= t;
+						return a < 0 ? -r : r;
+					}
+
+		template <size_t M>
+		constexpr CQuBitFixed<_T, M>	resize(void) const
+					{
+					CQuBitFixed<_T, M> ans;
+					size_t i = 0;
+
+						for(i=0;i<m_iCount && i<M;i++)
+							ans.m_qList[i] = m_qList[i];
+						ans.m_iCount = i;
+						ans.m_eType = m_eType;
+						ans.m_eEigenType = m_eEigenType;
+						ans.m_bResult = m_bResult;
+						return ans;
+					}
+
+		/*
+		** Operator Handling
+		** As in CQuBit, an operation on a collapsed result gives an empty superposition
+		*/
+		template <size_t M>
+		constexpr CQuBitFixed<_T, N*M>	oper(const CQuBitFixed<_T, M> &b, tQuOper op) const
+					{
+					CQuBitFixed<_T, N*M> ans;
+					size_t i = 0, j = 0;
+
+						if (m_eType == eCollapsedResult || b.m_eType == eCollapsedResult)
+							return ans;
+						for(i=0;i<m_iCount;i++)
+							for(j=0;j<b.m_iCount;j++)
+								ans.Add(Apply(op, m_qList[i], b.m_qList[j]));
+						ans.m_eType = m_eType;
+						return ans;
+					}
+		constexpr CQuBitFixed<_T, N>	oper_type(const _T &b, tQuOper op, bool bScalarLeft) const
+					{
+					CQuBitFixed<_T, N> ans;
+					size_t i = 0;
+
+						if (m_eType == eCollapsedResult)
+							return ans;
+						for(i=0;i<m_iCount;i++)
+							ans.Add(bScalarLeft ? Apply(op, b, m_qList[i]) : Apply(op, m_qList[i], b));
+						ans.m_eType = m_eType;
+						return ans;
+					}
+		constexpr CQuBitFixed<_T, N>	unary(tQuFixUnary op) const
+					{
+					CQuBitFixed<_T, N> ans;
+					size_t i = 0;
+
+						if (m_eType == eCollapsedResult)
+							return ans;
+						for(i=0;i<m_iCount;i++)
+							{
+							const _T &a = m_qList[i];
+
+							switch(op)
+								{
+								case eQuFixNot:	ans.Add(!a);				break;
+								case eQuFixOne:	ans.Add((_T)~integer(a));	break;
+								case eQuFixNeg:	ans.Add(-a);				break;
+								}
+							}
+						ans.m_eType = m_eType;
+						return ans;
+					}
+		constexpr CQuBitFixed<_T, N>	shift(int iBits, bool bLeft) const
+					{
+					CQuBitFixed<_T, N> ans;
+					size_t i = 0;
+
+						if (m_eType == eCollapsedResult)
+							return ans;
+						for(i=0;i<m_iCount;i++)
+							ans.Add(bLeft ? (_T)(integer(m_qList[i]) << iBits) : (_T)(integer(m_qList[i]) >> iBits));
+						ans.m_eType = m_eType;
+						return ans;
+					}
+
+		template <size_t M>
+		constexpr CQuBitFixed<_T, N>	condition(const CQuBitFixed<_T, M> &b, tQuCond co) const
+					{
+					CQuBitFixed<_T, N> ans;
+					bool rt = false, conj = true, disj = false;
+					size_t i = 0, j = 0;
+
+						if (m_eType == eCollapsedResult || b.m_eType == eCollapsedResult)
+							return ans;
+
+						for(i=0;i<m_iCount;i++)
+							{
+							conj = true;
+							disj = false;
+							for(j=0;j<b.m_iCount;j++)
+								{
+								rt = Compare(co, m_qList[i], b.m_qList[j]);
+								conj &= rt;
+								disj |= rt;
+								}
+							if ((b.m_eType == eConj && conj) || (b.m_eType == eDisj && disj))
+								ans.m_qList[ans.m_iCount++] = m_qList[i];
+							}
+						return ans.collapse(*this);
+					}
+		constexpr CQuBitFixed<_T, N>	condition_type(const _T &b, tQuCond co) const
+					{
+					CQuBitFixed<_T, N> ans;
+					size_t i = 0;
+
+						if (m_eType == eCollapsedResult)
+							return ans;
+
+						for(i=0;i<m_iCount;i++)
+							if (Compare(co, m_qList[i], b))
+								ans.m_qList[ans.m_iCount++] = m_qList[i];
+						return ans.collapse(*this);
+					}
+		/* Turns the eigenstates gathered from a into a collapsed result */
+		constexpr CQuBitFixed<_T, N> &	collapse(const CQuBitFixed<_T, N> &a)
+					{
+						m_eType = eCollapsedResult;
+						m_eEigenType = a.m_eType;
+						m_bResult = a.m_eType == eConj ? m_iCount == a.m_iCount : m_iCount != 0;
+						return *this;
+					}
+
+		_T			m_qList[N];
+		size_t		m_iCount;
+		tQuSuper	m_eType;
+		tQuSuper	m_eEigenType;
+		bool		m_bResult;
+};
+
+
+#endif	// QUFIXED_H
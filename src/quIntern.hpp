@@ -0,0 +1,159 @@
+#ifndef QUINTERN_H
+#define QUINTERN_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Interning of identical superpositions
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <stdint.h>
+#include "quBit.hpp"
+
+using namespace std;
+
+/* The fewest entries the table is swept of expired ones at */
+#define QUBIT_INTERN_SWEEP		64
+
+
+/*
+** Opt-in, process-wide table of immutable superpositions, one per CQuBit
+** type, keyed by GetFingerprint(). Interning a superposition whose contents
+** are already held returns a handle to that copy, so the same factor set or
+** range worked out in many places is only stored once, and two interned
+** handles are identical exactly when they are the same pointer. e.g.
+**	CQuIntern<float>::tQuHandle f1 = QuIntern(QFactors(360));
+**	CQuIntern<float>::tQuHandle f2 = QuIntern(QFactors(360));
+**	assert(f1 == f2);
+**
+** Contents are compared in full (with IsIdentical) before a handle is
+** shared, so a fingerprint collision only costs the comparison. The table
+** only holds weak references: a superposition is freed with its last
+** handle, and its entry is swept out later.
+*/
+template <typename _T>
+class CQuIntern {
+
+	public:
+		typedef shared_ptr<const CQuBit<_T> >	tQuHandle;
+
+		CQuIntern() : m_iHits(0), m_iMisses(0), m_iSweepAt(QUBIT_INTERN_SWEEP) {}
+
+		static CQuIntern<_T> &Get(void)
+					{
+					static CQuIntern<_T> table;
+
+						return table;
+					}
+
+		/* The shared copy of q's contents, adding one if there is none */
+		tQuHandle	Intern(const CQuBit<_T> &q)
+					{
+					uint64_t iKey = q.GetFingerprint();
+					tQuHandle pFound;
+
+						{
+						lock_guard<mutex> lock(m_Lock);
+
+							if (find(iKey, q, pFound))
+								return pFound;
+						}
+						return insert(iKey, tQuHandle(new CQuBit<_T>(q)));
+					}
+
+		/* Drops the table's references. Handles already given out stay valid, but are no longer shared. */
+		void		Clear(void)
+					{
+					lock_guard<mutex> lock(m_Lock);
+
+						m_Table.clear();
+						m_iSweepAt = QUBIT_INTERN_SWEEP;
+					}
+		void		ResetCounters(void)
+					{
+					lock_guard<mutex> lock(m_Lock);
+
+						m_iHits = m_iMisses = 0;
+					}
+
+		/*
+		** Tuning
+		*/
+inline	size_t		GetHits(void) const		{ return m_iHits; }
+inline	size_t		GetMisses(void) const	{ return m_iMisses; }
+		/* Superpositions held, i.e. with a handle still alive */
+		size_t		GetEntries(void)
+					{
+					lock_guard<mutex> lock(m_Lock);
+
+						sweep();
+						return m_Table.size();
+					}
+
+	private:
+		typedef unordered_multimap<uint64_t, weak_ptr<const CQuBit<_T> > >	tTable;
+
+		/* Called with the lock held */
+		bool		find(uint64_t iKey, const CQuBit<_T> &q, tQuHandle &pFound)
+					{
+					pair<typename tTable::iterator, typename tTable::iterator> range = m_Table.equal_range(iKey);
+					typename tTable::iterator it;
+
+						for(it=range.first;it!=range.second;++it)
+							{
+							pFound = it->second.lock();
+							if (pFound && pFound->IsIdentical(q))
+								{
+								m_iHits++;
+								return true;
+								}
+							}
+						pFound.reset();
+						return false;
+					}
+		/* Another thread may have added the same contents while q was copied */
+		tQuHandle	insert(uint64_t iKey, const tQuHandle &pNew)
+					{
+					lock_guard<mutex> lock(m_Lock);
+					tQuHandle pFound;
+
+						if (find(iKey, *pNew, pFound))
+							return pFound;
+						m_iMisses++;
+						m_Table.insert(make_pair(iKey, weak_ptr<const CQuBit<_T> >(pNew)));
+						if (m_Table.size() >= m_iSweepAt)
+							{
+							sweep();
+							m_iSweepAt = 2*m_Table.size() > QUBIT_INTERN_SWEEP ? 2*m_Table.size() : QUBIT_INTERN_SWEEP;
+							}
+						return pNew;
+					}
+		/* Removes the entries whose last handle has gone. Called with the lock held. */
+		void		sweep(void)
+					{
+					typename tTable::iterator it;
+
+						for(it=m_Table.begin();it!=m_Table.end();)
+							if (it->second.expired())
+								it = m_Table.erase(it);
+							else
+								++it;
+					}
+
+		mutex			m_Lock;
+		tTable			m_Table;
+		size_t			m_iHits;
+		size_t			m_iMisses;
+		size_t			m_iSweepAt;		/* table size that sets off the next sweep */
+};
+
+template <typename _T>
+typename CQuIntern<_T>::tQuHandle QuIntern(const CQuBit<_T> &q)	{ return CQuIntern<_T>::Get().Intern(q); }
+
+
+#endif	// QUINTERN_H
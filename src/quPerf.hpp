@@ -0,0 +1,206 @@
+#ifndef QUPERF_H
+#define QUPERF_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Hardware performance counters
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <iostream>
+#include <cstring>
+#include <stdint.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif
+
+using namespace std;
+
+
+typedef enum { eQuPerfCycles, eQuPerfInstructions, eQuPerfL1DMisses, eQuPerfLLCMisses,
+			   eQuPerfBranchMisses, eQuPerfCount, } tQuPerfEvent;
+
+
+/*
+** A set of counter values, or the difference between two
+*/
+struct CQuPerfSample {
+	uint64_t	m_iCount[eQuPerfCount];
+
+	CQuPerfSample()		{ memset(m_iCount, 0, sizeof(m_iCount)); }
+
+	CQuPerfSample &operator+=(const CQuPerfSample &s)
+				{
+				int i;
+
+					for(i=0;i<eQuPerfCount;i++)
+						m_iCount[i] += s.m_iCount[i];
+					return *this;
+				}
+	CQuPerfSample operator-(const CQuPerfSample &s) const
+				{
+				CQuPerfSample d;
+				int i;
+
+					for(i=0;i<eQuPerfCount;i++)
+						d.m_iCount[i] = m_iCount[i] > s.m_iCount[i] ? m_iCount[i] - s.m_iCount[i] : 0;
+					return d;
+				}
+
+	static const char *GetName(tQuPerfEvent e)
+				{
+				static const char *pNames[eQuPerfCount] = {
+					"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", };
+
+					return e < eQuPerfCount ? pNames[e] : "";
+				}
+
+	friend  ostream &operator<<(ostream &os, const CQuPerfSample &s)
+				{
+				int i;
+
+					for(i=0;i<eQuPerfCount;i++)
+						os << (i ? ", " : "") << s.m_iCount[i] << " " << GetName((tQuPerfEvent)i);
+					return os;
+				}
+};
+
+
+/*
+** The calling thread's counters, through Linux perf_event_open. Each event
+** is opened on its own, so those the CPU or kernel will not give (e.g. in a
+** VM, or with a high kernel.perf_event_paranoid) simply read as 0; check
+** IsAvailable. Elsewhere, none are available. User-space events only.
+**
+** Events are inherited, so they also count the threads this one starts
+** once they have been opened, from the moment those threads finish. The
+** workers QuParallelFor starts for an operation are joined before it ends,
+** so its counts cover all of its chunks, not just the calling thread's.
+*/
+class CQuPerfCounters {
+
+	public:
+		CQuPerfCounters()
+					{
+					int i;
+
+						for(i=0;i<eQuPerfCount;i++)
+							m_iFd[i] = open_event((tQuPerfEvent)i);
+					}
+		~CQuPerfCounters()
+					{
+#ifdef __linux__
+					int i;
+
+						for(i=0;i<eQuPerfCount;i++)
+							if (m_iFd[i] >= 0)
+								close(m_iFd[i]);
+#endif
+					}
+
+		/* One set per thread, as counters only follow the thread that opened them (and its children) */
+		static CQuPerfCounters &Local(void)
+					{
+					static thread_local CQuPerfCounters counters;
+
+						return counters;
+					}
+
+		bool		IsAvailable(tQuPerfEvent e) const	{ return m_iFd[e] >= 0; }
+		bool		IsAvailable(void) const
+					{
+					int i;
+
+						for(i=0;i<eQuPerfCount;i++)
+							if (m_iFd[i] >= 0)
+								return true;
+						return false;
+					}
+
+		/* Counts since the counters were opened, scaled up if the kernel had to share them out */
+		void		Read(CQuPerfSample &s) const
+					{
+#ifdef __linux__
+					uint64_t v[3];		/* value, time enabled, time running */
+					int i;
+
+						for(i=0;i<eQuPerfCount;i++)
+							{
+							s.m_iCount[i] = 0;
+							if (m_iFd[i] < 0 || read(m_iFd[i], v, sizeof(v)) != sizeof(v))
+								continue;
+							s.m_iCount[i] = v[2] && v[2] < v[1] ? (uint64_t)((double)v[0] * v[1] / v[2]) : v[0];
+							}
+#else
+						s = CQuPerfSample();
+#endif
+					}
+
+	private:
+		static int	open_event(tQuPerfEvent e)
+					{
+#ifdef __linux__
+					struct perf_event_attr attr;
+
+						memset(&attr, 0, sizeof(attr));
+						attr.size = sizeof(attr);
+						attr.exclude_kernel = 1;
+						attr.exclude_hv = 1;
+						attr.inherit = 1;
+						attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+						attr.type = PERF_TYPE_HARDWARE;
+						switch(e)
+							{
+							case eQuPerfCycles:			attr.config = PERF_COUNT_HW_CPU_CYCLES;		break;
+							case eQuPerfInstructions:	attr.config = PERF_COUNT_HW_INSTRUCTIONS;	break;
+							case eQuPerfLLCMisses:		attr.config = PERF_COUNT_HW_CACHE_MISSES;	break;
+							case eQuPerfBranchMisses:	attr.config = PERF_COUNT_HW_BRANCH_MISSES;	break;
+							case eQuPerfL1DMisses:
+								attr.type = PERF_TYPE_HW_CACHE;
+								attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+											  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+								break;
+							default:
+								return -1;
+							}
+						return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+						(void)e;
+						return -1;
+#endif
+					}
+
+		int			m_iFd[eQuPerfCount];
+};
+
+
+/*
+** Adds the counts over its own lifetime to a sample, e.g.
+**	CQuPerfSample s;
+**	{ CQuPerfRegion r(s); answer = a * b; }
+**	cout << s;
+*/
+class CQuPerfRegion {
+
+	public:
+		CQuPerfRegion(CQuPerfSample &total) : m_pTotal(&total)	{ CQuPerfCounters::Local().Read(m_Start); }
+		~CQuPerfRegion()
+					{
+					CQuPerfSample end;
+
+						CQuPerfCounters::Local().Read(end);
+						*m_pTotal += end - m_Start;
+					}
+
+	private:
+		CQuPerfSample *	m_pTotal;
+		CQuPerfSample	m_Start;
+};
+
+
+#endif	// QUPERF_H
@@ -0,0 +1,388 @@
+#ifndef QUPLAN_H
+#define QUPLAN_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Per-operation planning
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <limits>
+#include <functional>
+#include <type_traits>
+#include <stdint.h>
+#include "quCache.hpp"
+#include "quStats.hpp"
+
+using namespace std;
+
+/* Below this many pairs of states, the nested loop is used without looking at the operands */
+#define QUBIT_PLAN_MIN_WORK		256
+/* The widest span of integers a bitset is built over */
+#define QUBIT_PLAN_BITSET_MAX	(1<<26)
+/* The most slots a hash table starts with, however many states are expected */
+#define QUBIT_PLAN_HASH_MAX		(1<<22)
+/* The longest convolution, in values, a sumset is found by */
+#define QUBIT_PLAN_FFT_MAX		(1<<22)
+
+/* Estimated costs, relative to comparing two states */
+#define QUBIT_PLAN_COST_HASH	4.0		/* probing a hash table */
+#define QUBIT_PLAN_COST_BIT		1.0		/* testing and setting a bit */
+#define QUBIT_PLAN_COST_SORT	2.0		/* per n.log2(n), sorting */
+#define QUBIT_PLAN_COST_FFT		4.0		/* per n.log2(n), for each transform */
+
+
+/*
+** Strategies
+** An operation either generates states (from each pair, or each state, of
+** its operands) and drops duplicates, or tests states of one operand against
+** another. Each plan does one of those in its own way:
+**	nested		every pair is visited, and each new state is compared to every
+**				state kept so far, as Add does
+**	hash		states kept so far are found through a hash table
+**	sort-merge	the right hand operand is sorted, and searched (or merged, if
+**				the left is already in order)
+**	bitset		integer states are marked off in a bitset over their span
+**	range		both operands are evenly spaced integers, so the result can
+**				be worked out without looking at every pair
+**	convolve	integer sums or differences are found by convolving the
+**				operands over their spans (see quFFT.hpp), then put in order
+**				from as few pairs as it takes to see each one
+**	direct		the operation is one to one (e.g. adding a constant to
+**				integers), so distinct states give distinct results, which are
+**				kept without looking for duplicates at all
+** Every plan gives the same states, in the same order, with the same weights.
+*/
+typedef enum { eQuPlanNested, eQuPlanHash, eQuPlanSortMerge, eQuPlanBitset, eQuPlanRange,
+			   eQuPlanConvolve, eQuPlanDirect, eQuPlanCount, } tQuPlan;
+
+
+inline atomic<int> &QuPlanRef(void)
+{
+static atomic<int> iPlan(eQuPlanCount);
+
+	return iPlan;
+}
+
+/* Uses one plan wherever it applies, e.g. eQuPlanNested for the original
+   behaviour. eQuPlanCount (the default) lets the planner choose. */
+inline void QuSetPlan(tQuPlan ePlan)
+{
+	QuPlanRef() = ePlan;
+}
+
+inline tQuPlan QuGetPlan(void)
+{
+	return (tQuPlan)QuPlanRef().load();
+}
+
+
+/*
+** Cheap operand statistics, from one pass over the states
+*/
+template <typename _T>
+struct CQuShape {
+	size_t	m_iCount;
+	_T		m_Min;
+	_T		m_Max;
+	int64_t	m_iStep;		/* between consecutive states, when they are a progression */
+	bool	m_bAscending;	/* strictly */
+	bool	m_bProgression;	/* integers, evenly spaced, in order (ascending or descending) */
+	bool	m_bNaN;			/* which min and max leave out */
+
+	CQuShape() : m_iCount(0), m_Min(), m_Max(), m_iStep(0), m_bAscending(false),
+				 m_bProgression(false), m_bNaN(false) {}
+
+	/* Only numbers are measured; other states are just counted, and are
+	   left to the nested loop (see CQuBit::plan_measure) */
+	void	Measure(const _T *p, size_t n)
+			{
+				m_iCount = n;
+				if constexpr (is_arithmetic<_T>::value)
+					measure(p, n);
+			}
+	double	GetSpan(void) const
+			{
+				if constexpr (is_arithmetic<_T>::value)
+					return m_iCount ? (double)m_Max - (double)m_Min : 0;
+				else
+					return 0;
+			}
+
+	static uint64_t bits(const _T &v)
+			{
+				if constexpr (is_integral<_T>::value)
+					return (uint64_t)v;
+				else
+					return 0;
+			}
+
+private:
+	void	measure(const _T *p, size_t n)
+			{
+			uint64_t iStep = 0;
+			size_t i;
+			bool bFirst = true;
+
+				m_Min = m_Max = _T();
+				m_bAscending = true;
+				m_bProgression = is_integral<_T>::value && n >= 2;
+				m_bNaN = false;
+				if (m_bProgression)
+					iStep = bits(p[1]) - bits(p[0]);
+				m_iStep = (int64_t)iStep;
+
+				for(i=0;i<n;i++)
+					{
+					if (p[i] != p[i])
+						{
+						m_bNaN = true;
+						m_bAscending = false;
+						continue;
+						}
+					if (bFirst || p[i] < m_Min)	m_Min = p[i];
+					if (bFirst || m_Max < p[i])	m_Max = p[i];
+					bFirst = false;
+					if (i == 0)
+						continue;
+					if (!(p[i-1] < p[i]))
+						m_bAscending = false;
+					/* unsigned arithmetic, so a wide span can not overflow */
+					if (m_bProgression && (bits(p[i]) - bits(p[i-1]) != iStep ||
+										   (m_iStep > 0) != (p[i-1] < p[i])))
+						m_bProgression = false;
+					}
+				/* steps are only trusted well inside the range of a double */
+				if (GetSpan() > 4e15 || (double)m_Min < -4e15 || (double)m_Max > 4e15)
+					m_bProgression = false;
+			}
+};
+
+
+/*
+** What the planner chose for an operation, and why
+*/
+struct CQuPlanInfo {
+	tQuKind		m_eKind;				/* eQuKindCount, if nothing has been planned */
+	tQuPlan		m_ePlan;
+	uint64_t	m_iLhs;					/* operand sizes */
+	uint64_t	m_iRhs;
+	double		m_fCost[eQuPlanCount];	/* estimated, for each plan; < 0 where it does not apply */
+
+	CQuPlanInfo() : m_eKind(eQuKindCount), m_ePlan(eQuPlanNested), m_iLhs(0), m_iRhs(0)
+			{
+			int i;
+
+				for(i=0;i<eQuPlanCount;i++)
+					m_fCost[i] = -1;
+			}
+	CQuPlanInfo(tQuKind eKind, uint64_t iLhs, uint64_t iRhs, double fNested)
+			: CQuPlanInfo()
+			{
+				m_eKind = eKind;
+				m_iLhs = iLhs;
+				m_iRhs = iRhs;
+				m_fCost[eQuPlanNested] = fNested;
+			}
+
+	/* The cheapest plan that applies, unless QuSetPlan asked for another */
+	tQuPlan	Choose(void)
+			{
+			tQuPlan eForced = QuGetPlan();
+			int i;
+
+				m_ePlan = eQuPlanNested;
+				if (eForced < eQuPlanCount && m_fCost[eForced] >= 0)
+					m_ePlan = eForced;
+				else
+					for(i=0;i<eQuPlanCount;i++)
+						if (m_fCost[i] >= 0 && m_fCost[i] < m_fCost[m_ePlan])
+							m_ePlan = (tQuPlan)i;
+				return m_ePlan;
+			}
+	double	GetCost(void) const		{ return m_fCost[m_ePlan]; }
+
+	static const char *GetName(tQuPlan ePlan)
+			{
+			static const char *pNames[eQuPlanCount] = { "nested", "hash", "sort-merge", "bitset", "range", "convolve", "direct", };
+
+				return ePlan < eQuPlanCount ? pNames[ePlan] : "";
+			}
+
+	/* e.g. "oper 1000 x 1000: bitset, cost 1.00e+06 (nested 5.00e+11, hash 4.00e+06, bitset 1.00e+06)" */
+	string	Explain(void) const
+			{
+			ostringstream os;
+			int i;
+
+				if (m_eKind == eQuKindCount)
+					return "not the result of an operation";
+
+				os.precision(2);
+				os << scientific << CQuBitStats::GetKindName(m_eKind) << " " << m_iLhs << " x " << m_iRhs
+				   << ": " << GetName(m_ePlan) << ", cost " << GetCost() << " (";
+				for(i=0;i<eQuPlanCount;i++)
+					if (m_fCost[i] >= 0)
+						os << (i ? ", " : "") << GetName((tQuPlan)i) << " " << m_fCost[i];
+				os << ")";
+				return os.str();
+			}
+
+	friend  ostream &operator<<(ostream &os, const CQuPlanInfo &p)	{ return os << p.Explain(); }
+};
+
+
+/*
+** Finds states already kept, for the hash and bitset plans. The states
+** themselves stay in the caller's list; this only indexes them, so the
+** caller must append each state Insert reports as new.
+*/
+template <typename _T>
+class CQuDedup {
+
+	public:
+		/* A hash table, sized for about iExpected states (it grows as needed) */
+		CQuDedup(size_t iExpected) : m_bBitset(false), m_Lo(), m_iUsed(0)
+					{
+					size_t iSize = 16;
+
+						while(iSize < iExpected*2 && iSize < QUBIT_PLAN_HASH_MAX)
+							iSize *= 2;
+						m_Table.assign(iSize, EMPTY);
+					}
+		/* A bitset over the integers lo..hi */
+		CQuDedup(const _T &lo, const _T &hi) : m_bBitset(true), m_Lo(lo), m_iUsed(0)
+					{
+						m_Bits.assign((offset(hi) >> 6) + 1, 0);
+					}
+
+		/* Indexes states that are already unique */
+		template <typename _L>
+		void		Index(const _L &states)
+					{
+					size_t i;
+
+						for(i=0;i<states.size();i++)
+							add(states, states[i], i);
+					}
+
+		template <typename _L>
+		bool		Contains(const _L &states, const _T &v) const
+					{
+						return m_bBitset ? test(v) : find(states, v) != EMPTY;
+					}
+
+		/* True if v is new, and is to be appended to states. Otherwise, in a hash
+		   table, *pIndex is set to the equal state's index (a bitset does not know). */
+		template <typename _L>
+		bool		Insert(const _L &states, const _T &v, size_t *pIndex = NULL)
+					{
+					size_t i;
+
+						if (m_bBitset)
+							{
+							if (test(v))
+								return false;
+							add(states, v, states.size());
+							return true;
+							}
+						i = find(states, v);
+						if (i != EMPTY)
+							{
+							if (pIndex)	*pIndex = i;
+							return false;
+							}
+						add(states, v, states.size());
+						return true;
+					}
+
+	private:
+		static constexpr size_t EMPTY = (size_t)-1;
+
+		uint64_t	offset(const _T &v) const	{ return CQuShape<_T>::bits(v) - CQuShape<_T>::bits(m_Lo); }
+		bool		in_span(const _T &v) const	{ return !(v < m_Lo) && offset(v) < m_Bits.size()*64; }
+		bool		test(const _T &v) const
+					{
+						if (!in_span(v))
+							return find_outside(v);
+						return (m_Bits[offset(v) >> 6] >> (offset(v) & 63)) & 1;
+					}
+		/* 0 and -0 must hash alike, as they are equal */
+		static size_t hash_of(const _T &v)
+					{
+						return (size_t)QuMix64(v == _T() ? 0 : (uint64_t)std::hash<_T>()(v));
+					}
+		template <typename _L>
+		size_t		find(const _L &states, const _T &v) const
+					{
+					size_t iMask = m_Table.size()-1, h = hash_of(v) & iMask;
+
+						for(;m_Table[h]!=EMPTY;h=(h+1)&iMask)
+							if (states[m_Table[h]] == v)
+								return m_Table[h];
+						return EMPTY;
+					}
+		/* states at index i (which may not be in states yet) include v */
+		template <typename _L>
+		void		add(const _L &states, const _T &v, size_t i)
+					{
+					size_t iMask, h;
+
+						if (m_bBitset)
+							{
+							if (in_span(v))
+								m_Bits[offset(v) >> 6] |= (uint64_t)1 << (offset(v) & 63);
+							else
+								m_Outside.push_back(v);		/* only if the planner's bounds were wrong */
+							return;
+							}
+						if ((m_iUsed+1)*2 > m_Table.size())
+							grow(states);
+						iMask = m_Table.size()-1;
+						for(h=hash_of(v)&iMask;m_Table[h]!=EMPTY;h=(h+1)&iMask)
+							;
+						m_Table[h] = i;
+						m_iUsed++;
+					}
+		template <typename _L>
+		void		grow(const _L &states)
+					{
+					vector<size_t> old(m_Table.size()*2, EMPTY);
+					size_t iMask = old.size()-1, h, i;
+
+						old.swap(m_Table);
+						for(i=0;i<old.size();i++)
+							if (old[i] != EMPTY)
+								{
+								for(h=hash_of(states[old[i]])&iMask;m_Table[h]!=EMPTY;h=(h+1)&iMask)
+									;
+								m_Table[h] = old[i];
+								}
+					}
+		bool		find_outside(const _T &v) const
+					{
+					size_t i;
+
+						for(i=0;i<m_Outside.size();i++)
+							if (m_Outside[i] == v)
+								return true;
+						return false;
+					}
+
+		bool				m_bBitset;
+		_T					m_Lo;
+		size_t				m_iUsed;
+		vector<size_t>		m_Table;		/* indices into the states, or EMPTY */
+		vector<uint64_t>	m_Bits;
+		vector<_T>			m_Outside;
+};
+
+
+#endif	// QUPLAN_H
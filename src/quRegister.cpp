@@ -0,0 +1,335 @@
+/*
+** QuBit - State-vector register simulation
+*/
+#include <cmath>
+#include "quRegister.hpp"
+
+/* Below this many amplitude pairs, a gate is applied on one thread */
+#define QUBIT_REGISTER_GRAIN	(1<<14)
+
+
+CQuRegister::CQuRegister(unsigned iQubits)
+{
+	m_iQubits = 0;
+	if (iQubits > QUBIT_REGISTER_MAX_QUBITS)
+		return;
+
+	m_iQubits = iQubits;
+	m_State.resize((size_t)1 << iQubits);
+	Reset(0);
+}
+
+
+bool CQuRegister::Reset(uint64_t iBasis)
+{
+	if (iBasis >= m_State.size())
+		return false;
+
+	QuParallelFor(m_State.size(), QUBIT_REGISTER_GRAIN, [&](size_t, size_t iBegin, size_t iEnd)
+		{
+		for(size_t i=iBegin;i<iEnd;i++)
+			m_State[i] = 0;
+		});
+	m_State[iBasis] = 1;
+	return true;
+}
+
+
+double CQuRegister::GetNorm(void) const
+{
+vector<double> partial(QuChunkCount(m_State.size(), QUBIT_REGISTER_GRAIN), 0.0);
+double fNorm = 0;
+size_t i;
+
+	QuParallelFor(m_State.size(), QUBIT_REGISTER_GRAIN, [&](size_t iChunk, size_t iBegin, size_t iEnd)
+		{
+		double fSum = 0;
+
+		for(size_t j=iBegin;j<iEnd;j++)
+			fSum += norm(m_State[j]);
+		partial[iChunk] = fSum;
+		});
+
+	for(i=0;i<partial.size();i++)
+		fNorm += partial[i];
+	return fNorm;
+}
+
+
+/*
+** Gates
+*/
+bool CQuRegister::Apply(const tQuAmplitude m[4], unsigned iTarget, uint64_t iControls)
+{
+uint64_t iStride;
+
+	if (!is_qubit(iTarget) || iControls >= ((uint64_t)1 << m_iQubits))
+		return false;
+	iStride = (uint64_t)1 << iTarget;
+	if (iControls & iStride)
+		return false;
+
+	QuParallelFor(m_State.size()/2, QUBIT_REGISTER_GRAIN, [&](size_t, size_t iBegin, size_t iEnd)
+		{ apply_range(m, iStride, iControls, iBegin, iEnd); });
+	return true;
+}
+
+
+bool CQuRegister::H(unsigned q)
+{
+const tQuReal r = (tQuReal)M_SQRT1_2;
+const tQuAmplitude m[4] = { r, r, r, -r };
+
+	return Apply(m, q);
+}
+
+bool CQuRegister::X(unsigned q)
+{
+const tQuAmplitude m[4] = { 0, 1, 1, 0 };
+
+	return Apply(m, q);
+}
+
+bool CQuRegister::Y(unsigned q)
+{
+const tQuAmplitude m[4] = { 0, tQuAmplitude(0, -1), tQuAmplitude(0, 1), 0 };
+
+	return Apply(m, q);
+}
+
+bool CQuRegister::Z(unsigned q)					{ return Phase(q, M_PI); }
+bool CQuRegister::S(unsigned q)					{ return Phase(q, M_PI/2); }
+bool CQuRegister::T(unsigned q)					{ return Phase(q, M_PI/4); }
+
+bool CQuRegister::Phase(unsigned q, double fAngle)
+{
+const tQuAmplitude m[4] = { 1, 0, 0, polar((tQuReal)1, (tQuReal)fAngle) };
+
+	return Apply(m, q);
+}
+
+bool CQuRegister::Rx(unsigned q, double fAngle)
+{
+const tQuReal c = (tQuReal)cos(fAngle/2), s = (tQuReal)sin(fAngle/2);
+const tQuAmplitude m[4] = { c, tQuAmplitude(0, -s), tQuAmplitude(0, -s), c };
+
+	return Apply(m, q);
+}
+
+bool CQuRegister::Ry(unsigned q, double fAngle)
+{
+const tQuReal c = (tQuReal)cos(fAngle/2), s = (tQuReal)sin(fAngle/2);
+const tQuAmplitude m[4] = { c, -s, s, c };
+
+	return Apply(m, q);
+}
+
+bool CQuRegister::Rz(unsigned q, double fAngle)
+{
+const tQuAmplitude m[4] = { polar((tQuReal)1, (tQuReal)(-fAngle/2)), 0, 0, polar((tQuReal)1, (tQuReal)(fAngle/2)) };
+
+	return Apply(m, q);
+}
+
+bool CQuRegister::CNOT(unsigned iControl, unsigned iTarget)
+{
+	if (!is_qubit(iControl))
+		return false;
+	return MCX((uint64_t)1 << iControl, iTarget);
+}
+
+bool CQuRegister::CZ(unsigned iControl, unsigned iTarget)
+{
+const tQuAmplitude m[4] = { 1, 0, 0, -1 };
+
+	if (!is_qubit(iControl))
+		return false;
+	return Apply(m, iTarget, (uint64_t)1 << iControl);
+}
+
+bool CQuRegister::Toffoli(unsigned iControl1, unsigned iControl2, unsigned iTarget)
+{
+	if (!is_qubit(iControl1) || !is_qubit(iControl2))
+		return false;
+	return MCX(((uint64_t)1 << iControl1) | ((uint64_t)1 << iControl2), iTarget);
+}
+
+bool CQuRegister::MCX(uint64_t iControls, unsigned iTarget)
+{
+const tQuAmplitude m[4] = { 0, 1, 1, 0 };
+
+	return Apply(m, iTarget, iControls);
+}
+
+bool CQuRegister::Swap(unsigned a, unsigned b)
+{
+	if (!is_qubit(a) || !is_qubit(b))
+		return false;
+	if (a == b)
+		return true;
+	CNOT(a, b);
+	CNOT(b, a);
+	CNOT(a, b);
+	return true;
+}
+
+
+/*
+** Measurement
+*/
+CQuBit<uint64_t> CQuRegister::Measure(void) const
+{
+CQuBit<uint64_t> ans;
+double p;
+size_t i;
+
+	/* every basis state is distinct, so they can be stored without Add's search */
+	for(i=0;i<m_State.size();i++)
+		{
+		p = norm(m_State[i]);
+		if (p > QUBIT_REGISTER_EPSILON)
+			{
+			ans.m_qList.push_back(i);
+			ans.m_qWeights.push_back(p);
+			}
+		}
+	return ans.Any();
+}
+
+
+uint64_t CQuRegister::Collapse(void)
+{
+double fTarget = CQuRandom::Local().NextUnit() * GetNorm();
+double fSum = 0;
+uint64_t i, iSeen = 0;
+
+	for(i=0;i<m_State.size();i++)
+		{
+		double p = norm(m_State[i]);
+
+		if (p > 0)
+			iSeen = i;
+		fSum += p;
+		if (fSum > fTarget && p > 0)
+			break;
+		}
+
+	Reset(iSeen);
+	return iSeen;
+}
+
+
+bool CQuRegister::MeasureQubit(unsigned q)
+{
+double p1, p;
+bool bOne;
+uint64_t iBit;
+
+	if (!is_qubit(q))
+		return false;
+	p1 = probability_one(q);
+	bOne = CQuRandom::Local().NextUnit() < p1;
+	iBit = (uint64_t)1 << q;
+	p = bOne ? p1 : 1.0-p1;
+
+	QuParallelFor(m_State.size(), QUBIT_REGISTER_GRAIN, [&](size_t, size_t iBegin, size_t iEnd)
+		{
+		for(size_t i=iBegin;i<iEnd;i++)
+			if (((i & iBit) != 0) != bOne)
+				m_State[i] = 0;
+		});
+	if (p > 0)
+		scale((tQuReal)(1.0/sqrt(p)));
+	return bOne;
+}
+
+
+/*
+** Implementation
+*/
+/*
+** Applies m to the amplitude pairs k = [kBegin,kEnd). Pair k is made of the
+** amplitude whose index is k with a 0 inserted at the target bit, and its
+** partner with a 1 there. Consecutive k form runs of up to iStride pairs
+** with both halves contiguous, which are worked as plain real arithmetic
+** (std::complex multiplication would otherwise call out for NaN handling).
+*/
+void CQuRegister::apply_range(const tQuAmplitude m[4], uint64_t iStride, uint64_t iControls,
+								uint64_t kBegin, uint64_t kEnd)
+{
+const tQuReal m00r = m[0].real(), m00i = m[0].imag(), m01r = m[1].real(), m01i = m[1].imag();
+const tQuReal m10r = m[2].real(), m10i = m[2].imag(), m11r = m[3].real(), m11i = m[3].imag();
+uint64_t k = kBegin, j, iBase, n, i;
+tQuReal *p0, *p1;
+tQuReal a0r, a0i, a1r, a1i;
+
+	while(k < kEnd)
+		{
+		j = k & (iStride-1);
+		iBase = ((k - j) << 1) + j;
+		n = iStride - j < kEnd - k ? iStride - j : kEnd - k;
+		p0 = reinterpret_cast<tQuReal *>(&m_State[iBase]);
+		p1 = reinterpret_cast<tQuReal *>(&m_State[iBase + iStride]);
+
+		if (iControls == 0)
+			{
+			for(i=0;i<n;i++)
+				{
+				a0r = p0[2*i];	a0i = p0[2*i+1];
+				a1r = p1[2*i];	a1i = p1[2*i+1];
+				p0[2*i]   = m00r*a0r - m00i*a0i + m01r*a1r - m01i*a1i;
+				p0[2*i+1] = m00r*a0i + m00i*a0r + m01r*a1i + m01i*a1r;
+				p1[2*i]   = m10r*a0r - m10i*a0i + m11r*a1r - m11i*a1i;
+				p1[2*i+1] = m10r*a0i + m10i*a0r + m11r*a1i + m11i*a1r;
+				}
+			}
+		else
+			{
+			for(i=0;i<n;i++)
+				{
+				if (((iBase + i) & iControls) != iControls)
+					continue;
+				a0r = p0[2*i];	a0i = p0[2*i+1];
+				a1r = p1[2*i];	a1i = p1[2*i+1];
+				p0[2*i]   = m00r*a0r - m00i*a0i + m01r*a1r - m01i*a1i;
+				p0[2*i+1] = m00r*a0i + m00i*a0r + m01r*a1i + m01i*a1r;
+				p1[2*i]   = m10r*a0r - m10i*a0i + m11r*a1r - m11i*a1i;
+				p1[2*i+1] = m10r*a0i + m10i*a0r + m11r*a1i + m11i*a1r;
+				}
+			}
+		k += n;
+		}
+}
+
+
+double CQuRegister::probability_one(unsigned q) const
+{
+vector<double> partial(QuChunkCount(m_State.size(), QUBIT_REGISTER_GRAIN), 0.0);
+uint64_t iBit = (uint64_t)1 << q;
+double p = 0;
+size_t i;
+
+	QuParallelFor(m_State.size(), QUBIT_REGISTER_GRAIN, [&](size_t iChunk, size_t iBegin, size_t iEnd)
+		{
+		double fSum = 0;
+
+		for(size_t j=iBegin;j<iEnd;j++)
+			if (j & iBit)
+				fSum += norm(m_State[j]);
+		partial[iChunk] = fSum;
+		});
+
+	for(i=0;i<partial.size();i++)
+		p += partial[i];
+	return p;
+}
+
+
+void CQuRegister::scale(tQuReal fScale)
+{
+	QuParallelFor(m_State.size(), QUBIT_REGISTER_GRAIN, [&](size_t, size_t iBegin, size_t iEnd)
+		{
+		for(size_t i=iBegin;i<iEnd;i++)
+			m_State[i] *= fScale;
+		});
+}
@@ -0,0 +1,237 @@
+/*
+** QuBit - Factor and primality engine
+*/
+#include <algorithm>
+#include <mutex>
+#include "quSieve.hpp"
+
+
+CQuSieve::CQuSieve()
+{
+	m_iLimit = 0;
+	m_iMax = QUBIT_SIEVE_MAX < QUBIT_SIEVE_MIN ? QUBIT_SIEVE_MIN : QUBIT_SIEVE_MAX;
+}
+
+
+CQuSieve &CQuSieve::Get(void)
+{
+static CQuSieve sieve;
+
+	return sieve;
+}
+
+
+void CQuSieve::Reserve(uint32_t n)
+{
+	if (n < m_iLimit)
+		return;
+	if (n >= m_iMax)
+		n = m_iMax-1;
+
+	unique_lock<shared_mutex> lock(m_Lock);
+	Extend(n);
+}
+
+
+void CQuSieve::SetMaxLimit(uint32_t iMax)
+{
+	if (iMax < QUBIT_SIEVE_MIN)
+		iMax = QUBIT_SIEVE_MIN;
+
+	unique_lock<shared_mutex> lock(m_Lock);
+	m_iMax = iMax;
+	if (m_iLimit > iMax)
+		Truncate(iMax);
+}
+
+
+void CQuSieve::Release(void)
+{
+	unique_lock<shared_mutex> lock(m_Lock);
+	Truncate(0);
+}
+
+
+bool CQuSieve::IsPrime(uint32_t n)
+{
+	if (n < 2)
+		return false;
+	return SmallestFactor(n) == n;
+}
+
+
+uint32_t CQuSieve::SmallestFactor(uint32_t n)
+{
+	if (n < 2)
+		return n;
+	if (n >= m_iMax)
+		return TrialFactor(n);
+
+	Reserve(n);
+	{
+	shared_lock<shared_mutex> lock(m_Lock);
+
+		/* the table may have been cut back since */
+		if (n < m_iLimit)
+			return m_Spf[n];
+	}
+	return TrialFactor(n);
+}
+
+
+void CQuSieve::Factorise(uint32_t n, vector<uint32_t> &primes, vector<uint32_t> &powers)
+{
+uint32_t p;
+
+	primes.clear();
+	powers.clear();
+
+	while(n > 1)
+		{
+		p = SmallestFactor(n);
+		if (primes.size() && primes.back() == p)
+			powers.back()++;
+		else
+			{
+			primes.push_back(p);
+			powers.push_back(1);
+			}
+		n /= p;
+		}
+}
+
+
+void CQuSieve::Divisors(uint32_t n, vector<uint32_t> &divisors)
+{
+vector<uint32_t> primes, powers;
+size_t i, j, k, iCount;
+uint32_t pk;
+
+	divisors.clear();
+	if (n == 0)
+		return;
+
+	Factorise(n, primes, powers);
+	divisors.push_back(1);
+	for(i=0;i<primes.size();i++)
+		{
+		iCount = divisors.size();
+		pk = 1;
+		for(k=0;k<powers[i];k++)
+			{
+			pk *= primes[i];
+			for(j=0;j<iCount;j++)
+				divisors.push_back(divisors[j]*pk);
+			}
+		}
+	sort(divisors.begin(), divisors.end());
+}
+
+
+/*
+** Implementation
+*/
+/* Called with the lock held */
+void CQuSieve::Extend(uint32_t n)
+{
+uint32_t iLo = m_iLimit, iHi, iNewLimit;
+
+	if (n < iLo)
+		return;		/* another thread got here first */
+
+	/* Grow geometrically so repeated small requests do not each pay for a resize */
+	iNewLimit = iLo*2 > n+1 ? iLo*2 : n+1;
+	if (iNewLimit < QUBIT_SIEVE_SEGMENT)	iNewLimit = QUBIT_SIEVE_SEGMENT;
+	if (iNewLimit > m_iMax)				iNewLimit = m_iMax;
+
+	m_Spf.resize(iNewLimit, 0);
+	for(;iLo<iNewLimit;iLo=iHi)
+		{
+		iHi = iNewLimit-iLo > QUBIT_SIEVE_SEGMENT ? iLo+QUBIT_SIEVE_SEGMENT : iNewLimit;
+		SieveSegment(iLo, iHi);
+		}
+
+	m_iLimit = iNewLimit;
+}
+
+
+/* Called with the lock held. Keeps 0..iLimit-1, and hands the rest back. */
+void CQuSieve::Truncate(uint32_t iLimit)
+{
+	m_Spf.resize(iLimit);
+	m_Spf.shrink_to_fit();
+	m_Primes.erase(lower_bound(m_Primes.begin(), m_Primes.end(), iLimit), m_Primes.end());
+	m_Primes.shrink_to_fit();
+	m_iLimit = iLimit;
+}
+
+
+/*
+** Fills in m_Spf for [iLo,iHi). Every prime up to sqrt(iHi) is already known
+** (the first segment finds its own), so each segment only needs the primes
+** found by those before it.
+*/
+void CQuSieve::SieveSegment(uint32_t iLo, uint32_t iHi)
+{
+uint64_t iStart, j;
+uint32_t i, p;
+size_t k;
+
+	if (iLo < 2)
+		{
+		for(i=iLo;i<2 && i<iHi;i++)
+			m_Spf[i] = i;
+		iLo = 2;
+		}
+
+	for(k=0;k<m_Primes.size();k++)
+		{
+		p = m_Primes[k];
+		if ((uint64_t)p*p >= iHi)
+			break;
+		iStart = (uint64_t)p*p;
+		if (iStart < iLo)
+			iStart = ((uint64_t)iLo + p - 1) / p * p;
+		for(j=iStart;j<iHi;j+=p)
+			if (m_Spf[j] == 0)
+				m_Spf[j] = p;
+		}
+
+	/* whatever is left is prime, and may sieve the rest of this segment */
+	for(i=iLo;i<iHi;i++)
+		if (m_Spf[i] == 0)
+			{
+			m_Spf[i] = i;
+			m_Primes.push_back(i);
+			for(j=(uint64_t)i*i;j<iHi;j+=i)
+				if (m_Spf[j] == 0)
+					m_Spf[j] = i;
+			}
+}
+
+
+/* For numbers beyond the table, divide by the tabled primes up to sqrt(n) */
+uint32_t CQuSieve::TrialFactor(uint32_t n)
+{
+size_t k;
+
+	for(;;)
+		{
+		Reserve(65536);
+
+		shared_lock<shared_mutex> lock(m_Lock);
+
+		/* Release may have emptied the table in between */
+		if (m_iLimit <= 65536)
+			continue;
+		for(k=0;k<m_Primes.size();k++)
+			{
+			uint32_t p = m_Primes[k];
+			if ((uint64_t)p*p > n)
+				break;
+			if (n % p == 0)
+				return p;
+			}
+		return n;
+		}
+}
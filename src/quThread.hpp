@@ -0,0 +1,243 @@
+#ifndef QUTHREAD_H
+#define QUTHREAD_H
+
+/*
+** QuBit - Quantum Superposition Library
+** Worker thread helpers
+**
+** Freely Distributable under the GPL v2.0
+*/
+
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include "quTrace.hpp"
+
+using namespace std;
+
+/* Below this many work items, a job is run on the calling thread */
+#define QUBIT_PARALLEL_GRAIN	4096
+/* A deadline is only checked once per this much work (a power of 2) */
+#define QUBIT_PROGRESS_CLOCK	65536
+
+
+inline atomic<size_t> &QuThreadCountRef(void)
+{
+static atomic<size_t> iCount(0);
+
+	return iCount;
+}
+
+/* 0 selects one thread per hardware core, 1 disables threading altogether */
+inline void QuSetThreadCount(size_t iThreads)
+{
+	QuThreadCountRef() = iThreads;
+}
+
+inline size_t QuGetThreadCount(void)
+{
+size_t iThreads = QuThreadCountRef();
+
+	if (iThreads == 0)
+		iThreads = thread::hardware_concurrency();
+	return iThreads ? iThreads : 1;
+}
+
+/* Set while a thread is running a QuParallelFor chunk, so nested jobs run serially */
+inline bool &QuInWorker(void)
+{
+static thread_local bool bInWorker = false;
+
+	return bInWorker;
+}
+
+/* Number of chunks QuParallelFor will split iCount items into */
+inline size_t QuChunkCount(size_t iCount, size_t iGrain)
+{
+size_t iChunks, iThreads = QuGetThreadCount();
+
+	if (QuInWorker())	return 1;
+	if (iGrain == 0) iGrain = 1;
+	iChunks = (iCount + iGrain - 1) / iGrain;
+	if (iChunks > iThreads) iChunks = iThreads;
+	return iChunks ? iChunks : 1;
+}
+
+/*
+** Splits [0,iCount) into contiguous chunks of at least iGrain items, and
+** calls fn(iChunk, iBegin, iEnd) for each chunk on its own thread. The first
+** chunk runs on the calling thread. Chunks are numbered in order, so callers
+** can write partial results into a vector sized with QuChunkCount, and merge
+** them afterwards in a deterministic order.
+*/
+template <typename _F>
+size_t QuParallelFor(size_t iCount, size_t iGrain, _F fn)
+{
+size_t iChunks = QuChunkCount(iCount, iGrain);
+size_t iPer, i;
+vector<thread> pool;
+
+	if (iChunks <= 1)
+		{
+		fn((size_t)0, (size_t)0, iCount);
+		return 1;
+		}
+
+	iPer = (iCount + iChunks - 1) / iChunks;
+	for(i=1;i<iChunks;i++)
+		{
+		size_t iBegin = i*iPer < iCount ? i*iPer : iCount;
+		size_t iEnd = (i+1)*iPer < iCount ? (i+1)*iPer : iCount;
+		pool.push_back(thread([=]() 
+			{
+			QUBIT_TRACE_SCOPE("parallel_chunk", iBegin, iEnd);
+
+				QuInWorker() = true;
+				fn(i, iBegin, iEnd);
+			}));
+		}
+	{
+	QUBIT_TRACE_SCOPE("parallel_chunk", 0, iPer);
+
+		QuInWorker() = true;
+		fn((size_t)0, (size_t)0, iPer);
+	}
+	QuInWorker() = false;
+
+	for(i=0;i<pool.size();i++)
+		pool[i].join();
+	return iChunks;
+}
+
+
+
+/*
+** Cooperative cancellation and progress, for operations run through
+** quAsync.hpp. The long loops of an operation (pairwise operators and
+** conditions, set algebra, ranges and streams) report the work they have
+** done to the calling thread's CQuProgress, if it has one, and stop early
+** once it has been cancelled or its deadline has passed. What they leave
+** behind is then incomplete, so is not cached, and should be thrown away.
+**
+** Work is counted in states or pairs visited. Each operation adds its own
+** to the total as it starts, so GetFraction() can only be an estimate when
+** one operation runs others. Loops run by QuParallelFor's extra threads
+** are not counted.
+*/
+class CQuProgress {
+
+	public:
+		CQuProgress()		{ Reset(); }
+
+		void		Reset(void)
+					{
+						m_bCancel = false;
+						m_iDone = m_iTotal = 0;
+						m_iDeadline = 0;
+					}
+		void		Cancel(void)				{ m_bCancel = true; }
+inline	bool		IsCancelled(void) const		{ return m_bCancel.load(memory_order_relaxed); }
+		/* Cancels the job once fSeconds from now have passed */
+		void		SetDeadline(double fSeconds)
+					{
+						m_iDeadline = now() + (int64_t)(fSeconds * 1e9);
+						if (m_iDeadline == 0)
+							m_iDeadline = 1;
+					}
+
+inline	uint64_t	GetDone(void) const		{ return m_iDone.load(memory_order_relaxed); }
+inline	uint64_t	GetTotal(void) const	{ return m_iTotal.load(memory_order_relaxed); }
+		double		GetFraction(void) const
+					{
+					uint64_t iTotal = GetTotal(), iDone = GetDone();
+
+						return iTotal == 0 ? 0 : iDone >= iTotal ? 1 : (double)iDone / iTotal;
+					}
+
+		/* From the operations: iWork more to do, and iWork done. Step is true if they should stop. */
+		void		Begin(uint64_t iWork)	{ m_iTotal.fetch_add(iWork, memory_order_relaxed); }
+		bool		Step(uint64_t iWork)
+					{
+					uint64_t iDone = m_iDone.fetch_add(iWork, memory_order_relaxed);
+					int64_t iDeadline = m_iDeadline.load(memory_order_relaxed);
+
+						if (iDeadline && (iDone ^ (iDone + iWork)) >= QUBIT_PROGRESS_CLOCK && now() >= iDeadline)
+							m_bCancel = true;
+						return IsCancelled();
+					}
+		/* As Step, for waits that do no work of their own, so look at the clock every time */
+		bool		Poll(void)
+					{
+					int64_t iDeadline = m_iDeadline.load(memory_order_relaxed);
+
+						if (iDeadline && now() >= iDeadline)
+							m_bCancel = true;
+						return IsCancelled();
+					}
+
+	private:
+		static int64_t	now(void)
+					{
+						return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+					}
+
+		atomic<bool>		m_bCancel;
+		atomic<uint64_t>	m_iDone;
+		atomic<uint64_t>	m_iTotal;
+		atomic<int64_t>		m_iDeadline;	/* steady clock ns, or 0 */
+};
+
+/* The job the calling thread is running, if any */
+inline CQuProgress *&QuProgress(void)
+{
+static thread_local CQuProgress *pProgress = NULL;
+
+	return pProgress;
+}
+
+inline void QuProgressBegin(uint64_t iWork)
+{
+CQuProgress *p = QuProgress();
+
+	if (p)
+		p->Begin(iWork);
+}
+
+/* True if the calling thread's job has been cancelled, so the loop should stop */
+inline bool QuProgressStep(uint64_t iWork)
+{
+CQuProgress *p = QuProgress();
+
+	return p && p->Step(iWork);
+}
+
+inline bool QuProgressCancelled(void)
+{
+CQuProgress *p = QuProgress();
+
+	return p && p->IsCancelled();
+}
+
+inline bool QuProgressPoll(void)
+{
+CQuProgress *p = QuProgress();
+
+	return p && p->Poll();
+}
+
+/* Makes 'progress' the calling thread's job for the life of the scope */
+class CQuProgressScope {
+
+	public:
+		CQuProgressScope(CQuProgress &progress) : m_pPrevious(QuProgress())	{ QuProgress() = &progress; }
+		~CQuProgressScope()		{ QuProgress() = m_pPrevious; }
+
+	private:
+		CQuProgress *	m_pPrevious;
+};
+
+
+#endif	// QUTHREAD_H